@@ -0,0 +1,39 @@
+// Arena Allocator Header
+
+// scoped bump allocator for bursts of small allocations that die together
+// arena = list of page-granular chunks | alloc = bump a pointer | reset / destroy = drop everything at once
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ARENA_ALIGN       8u            // every allocation 8-byte aligned (same as kmalloc)
+#define ARENA_CHUNK_PAGES 1u            // pages per ordinary chunk (larger requests get a chunk of their own size)
+
+typedef struct arena_chunk {
+    struct arena_chunk *next;           // older chunk
+    uint32_t            pages;          // chunk size in pages
+} arena_chunk_t;
+
+typedef struct arena {
+    arena_chunk_t *chunks;              // newest first, the last one holds this header
+    char          *ptr;                 // next free byte of the newest chunk
+    char          *end;                 // end of the newest chunk
+    size_t         used;                // bytes handed out since create / reset
+} arena_t;
+
+// new arena (header lives in its first chunk), NULL = OOM
+arena_t *arena_create(void);
+
+// size bytes from the arena (NULL = OOM), never freed individually
+void *arena_alloc(arena_t *a, size_t size);
+
+// free every allocation at once, first chunk kept for reuse
+void arena_reset(arena_t *a);
+
+// free the arena and everything allocated from it
+void arena_destroy(arena_t *a);
+
+#endif
@@ -0,0 +1,21 @@
+// clockevent.h - Timer interrupt source abstraction
+
+// a clockevent device raises IRQ0-style timer interrupts either periodically or once after a delay
+// the tick code (timer.c) only talks to the device through these hooks, so another source
+// (e.g. a local APIC timer) can replace the PIT without touching the tick accounting
+
+#ifndef CLOCKEVENT_H
+#define CLOCKEVENT_H
+
+#include <stdint.h>
+
+typedef struct clockevent {
+    const char *name;
+    uint32_t    freq;                           // counter frequency (Hz)
+    uint32_t    max_delta;                      // longest programmable delay (counter units)
+    void      (*set_periodic)(uint32_t delta);  // interrupt every delta units
+    void      (*set_oneshot)(uint32_t delta);   // one interrupt after delta units, then silent
+    uint32_t  (*remaining)(void);               // units left before the next interrupt
+} clockevent_t;
+
+#endif
@@ -0,0 +1,49 @@
+// CPU helper instructions Header
+
+#ifndef CPU_H
+#define CPU_H
+
+#include <stdint.h>
+
+#define MAX_CPUS    1                   // uniprocessor today - per-CPU data is indexed by cpu_id()
+
+#define EFLAGS_IF   (1u << 9)           // interrupt enable flag
+
+// index of the executing CPU (always the BSP until SMP bring-up)
+static inline uint32_t cpu_id(void) {
+    return 0;
+}
+
+// disable interrupts, return previous EFLAGS for cpu_irq_restore
+static inline uint32_t cpu_irq_save(void) {
+    uint32_t flags;
+    asm volatile ("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+// re-enable interrupts only if they were enabled at cpu_irq_save
+static inline void cpu_irq_restore(uint32_t flags) {
+    if (flags & EFLAGS_IF)
+        asm volatile ("sti" : : : "memory");
+}
+
+// index of lowest set bit (v must be non-zero)
+static inline uint32_t cpu_bsf(uint32_t v) {
+    uint32_t idx;
+    asm volatile ("bsf %1, %0" : "=r"(idx) : "rm"(v));
+    return idx;
+}
+
+// execute CPUID leaf / subleaf
+static inline void cpu_cpuid(uint32_t leaf, uint32_t subleaf, uint32_t *a, uint32_t *b, uint32_t *c, uint32_t *d) {
+    asm volatile ("cpuid" : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d) : "a"(leaf), "c"(subleaf));
+}
+
+// read time-stamp counter (cycles since reset)
+static inline uint64_t rdtsc(void) {
+    uint32_t lo, hi;
+    asm volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+#endif
@@ -3,6 +3,7 @@
 // heap virtual address space = HEAP_START -> HEAP_END
 // heap block = [ header : 4B ][ payload ... ][ footer : 4B ]
 // header/footer encodes: bits[31:1] = total block size | bit[0] = allocated? flag
+// free block payload starts with pred/succ links of its size-class free list
 
 #ifndef KHEAP_H
 #define KHEAP_H
@@ -11,9 +12,15 @@
 #include <stddef.h>
 
 // virtual address layout
-#define HEAP_START 0x01000000u          // 16MB - above the 4 MB identity map
-#define HEAP_MAX 0x05000000u            // 64MB ceiling  (48 MB of usable heap space)
+#define HEAP_START 0xC1000000u          // kernel half, just above the 16MB direct map
+#define HEAP_MAX 0xC5000000u            // ceiling = 64MB of heap space (VMM_TEMP_WINDOW follows)
 #define HEAP_INITIAL (64 * 1024)         // 64KB initial free block (16 pages)
+#define KHEAP_VMALLOC_MIN (16 * 1024)   // kmalloc requests this large are served by vmalloc (vmalloc.h)
+
+// trim: a free block at the end of the heap larger than KHEAP_TRIM_THRESHOLD gives its pages back to the PMM,
+// keeping KHEAP_TRIM_KEEP bytes mapped so the next allocation burst does not remap at once
+#define KHEAP_TRIM_THRESHOLD (256 * 1024)
+#define KHEAP_TRIM_KEEP      HEAP_INITIAL
 
 // initialise kernel heap
 void kheap_init(void);
@@ -37,5 +44,9 @@ size_t kheap_size(void);                // total mapped heap bytes
 // print dump to serial
 void kheap_dump(void);
 
+#ifdef ORION_BENCH
+void kheap_bench(void);                 // boot-time trim check: free frames before / during / after an allocation burst
+#endif
+
 
 #endif
\ No newline at end of file
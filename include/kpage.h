@@ -0,0 +1,25 @@
+// Kernel Page Allocator Header
+
+// kpage virtual address space = KPAGE_START -> KPAGE_END
+// page-granular kernel allocations: whole frames from the PMM, mapped into their own region
+// (no header, no alignment padding: n pages of memory cost n frames)
+
+#ifndef KPAGE_H
+#define KPAGE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// virtual address layout (kernel half, right above the vmalloc range)
+#define KPAGE_START 0xD6000000u
+#define KPAGE_END   0xD8000000u         // 32MB = 8192 pages
+
+// allocate npages virtually contiguous, page aligned kernel pages (NULL = no space / OOM)
+void *kpage_alloc(uint32_t npages);
+
+// free pages returned by kpage_alloc (npages = count passed to kpage_alloc)
+void kpage_free(void *ptr, uint32_t npages);
+
+size_t kpage_used(void);                // bytes allocated
+
+#endif
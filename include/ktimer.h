@@ -0,0 +1,54 @@
+// ktimer.h - Kernel timers (hierarchical timing wheel)
+
+// one-shot callbacks at a tick deadline, for sleeps and timeouts
+// cost per tick = timers expiring (+ one cascade every 256 ticks), independent of how many processes exist
+// nanosecond timers (ktimer_add_ns) = short sorted list on clock_ns(), the clockevent is armed for the first one
+
+#ifndef KTIMER_H
+#define KTIMER_H
+
+#include <stdint.h>
+
+// wheel geometry: 256 one-tick slots, then 3 levels of 64 slots (each slot 64x wider than the level below)
+#define KTIMER_TV1_BITS   8
+#define KTIMER_TVN_BITS   6
+#define KTIMER_LEVELS     4
+#define KTIMER_MAX_DELAY  ((1u << (KTIMER_TV1_BITS + 3 * KTIMER_TVN_BITS)) - 1u)   // ~77 days at 100Hz, longer = clamped
+
+typedef void (*ktimer_fn_t)(void *arg);
+
+// timer = owned by the caller (embedded in its object), linked into the wheel while pending
+typedef struct ktimer {
+    struct ktimer  *next;
+    struct ktimer **pprev;              // link pointing at this timer (slot head or previous next)
+    uint32_t        expires;            // tick the callback runs at (wheel timers)
+    uint64_t        expires_ns;         // clock_ns() the callback runs at (ns timers)
+    ktimer_fn_t     fn;                 // runs in IRQ0 context, interrupts off
+    void           *arg;
+} ktimer_t;
+
+// arm t to call fn(arg) delay ticks from now (0 = next tick), re-arming a pending timer moves it
+void ktimer_add(ktimer_t *t, uint32_t delay, ktimer_fn_t fn, void *arg);
+
+// arm t to call fn(arg) delay_ns nanoseconds from now (clockevent resolution, ~1us on the PIT)
+void ktimer_add_ns(ktimer_t *t, uint64_t delay_ns, ktimer_fn_t fn, void *arg);
+
+// disarm t: 1 = was pending, 0 = already fired / never armed
+int ktimer_cancel(ktimer_t *t);
+
+// 1 = t is armed and has not fired yet
+int ktimer_pending(const ktimer_t *t);
+
+// IRQ0: run every timer due up to tick now
+void ktimer_run(uint32_t now);
+
+// IRQ0: run every ns timer due at clock_ns() now, return timers run
+uint32_t ktimer_run_ns(uint64_t now);
+
+// deadline of the first ns timer (0 = none pending)
+uint64_t ktimer_next_ns(void);
+
+// ticks from now until the wheel next has work (a timer or a cascade), capped at limit (>= 1)
+uint32_t ktimer_next_due(uint32_t now, uint32_t limit);
+
+#endif
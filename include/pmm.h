@@ -21,15 +21,78 @@
 #define PMM_BITMAP_SIZE (PMM_MAX_FRAMES / 32)               // 32 frames per uint32
 // 4GB total = 1,048,576 frames = 32768 uint32s = 128KB
 
+// buddy allocator: block of order k = 2^k physically contiguous frames, aligned to 2^k frames
+#define PMM_MAX_ORDER   10                                  // largest block = 2^10 frames = 4MB
+#define PMM_ORDER_FRAMES(order) (1u << (order))             // frames in a block of 'order'
+
+// memory zones (fallback order = requested zone, then lower zones above their low watermark)
+#define PMM_ZONE_DMA    0                                   // frames below 16MB: ISA DMA reachable, direct mapped at KERNEL_VIRT_BASE
+#define PMM_ZONE_NORMAL 1                                   // frames 16MB - 4GB: general allocations
+#define PMM_ZONE_COUNT  2
+#define PMM_DMA_LIMIT   0x01000000u                         // first byte above the DMA zone
+
+// per-CPU frame cache (magazine) in front of single-frame alloc/free
+#define PMM_CACHE_SIZE  64                                  // frames held per CPU
+#define PMM_CACHE_BATCH 16                                  // frames moved per refill / drain
+
+// pools of frames zeroed ahead of time by the idle thread (one per zone)
+#define PMM_ZERO_POOL_SIZE 32                               // zeroed NORMAL frames kept ready (128KB)
+#define PMM_ZERO_POOL_DMA  8                                // zeroed DMA frames kept ready (page tables)
+
+// deferred init: only RAM below PMM_EARLY_LIMIT (and the kernel image) goes into the buddy maps at boot
+#define PMM_EARLY_LIMIT 0x02000000u                         // 32MB: DMA zone + first NORMAL chunks
+#define PMM_DEFER_CHUNK 1024u                               // frames brought online per step (4MB = one max-order block)
+#define PMM_MAX_REGIONS 32                                  // usable mmap regions remembered for deferred init
+
+// page colouring: colour = frame % (cache way size / PAGE_SIZE), frames of one colour compete for the same cache sets
+#define PMM_MAX_COLORS  64                                  // colours tracked (larger caches are folded onto 64)
+#define PMM_COLOR_BIN   4                                   // frames kept ready per colour
+
 // parse GRUB's memory map and set up bitmap
 void pmm_init(multiboot_info_t *mbi, uint32_t kernel_phys_start, uint32_t kernel_phys_end);     // multiboot_info & physical addresses of loaded kernel start/end
 
+// idle-time work: bring the RAM above PMM_EARLY_LIMIT online (allocation failures also pull it in early)
+void pmm_init_deferred(void);
+
 // allocate one available physical page frame
 uint32_t pmm_alloc_frame(void);
 
 // release one reserved physical page frame
 void pmm_free_frame(uint32_t phys_addr);
 
+// allocate one frame from zone (with fallback order), 0 on failure
+uint32_t pmm_alloc_frame_zone(uint32_t zone);
+
+// allocate 2^order contiguous frames from zone (with fallback order), 0 on failure
+uint32_t pmm_alloc_frames_zone(uint32_t order, uint32_t zone);
+
+// allocate one frame whose contents are all zero (pre-zeroed pool first, zeroed synchronously otherwise)
+uint32_t pmm_alloc_zeroed_frame(void);
+uint32_t pmm_alloc_zeroed_frame_zone(uint32_t zone);
+
+// idle-time work: top up the pre-zeroed pool, return number of frames zeroed
+uint32_t pmm_zero_idle(void);
+
+// allocate one frame of the given colour (any colour when colouring is off or none is left), 0 on failure
+uint32_t pmm_alloc_frame_color(uint32_t color);
+
+// colour a virtual page should get so consecutive pages land on consecutive colours
+uint32_t pmm_page_color(uint32_t virt);
+
+// coloured allocation mode (on by default when CPUID leaf 4 reports more than one colour)
+void pmm_set_color_mode(int on);
+
+// allocate 2^order physically contiguous frames (base aligned to 2^order frames), 0 on failure
+uint32_t pmm_alloc_frames(uint32_t order);
+
+// release a block returned by pmm_alloc_frames (order must match the allocation)
+void pmm_free_frames(uint32_t phys_addr, uint32_t order);
+
+// shared frames (copy-on-write): a frame has 1 owner after allocation, each pmm_frame_ref adds one
+void     pmm_frame_ref(uint32_t phys_addr);             // add an owner
+void     pmm_frame_unref(uint32_t phys_addr);           // drop an owner, the last one frees the frame
+uint32_t pmm_frame_refcount(uint32_t phys_addr);        // current owners
+
 void print_uint32_hex(uint32_t v);
 void print_uint32_dec(uint32_t v);
 
@@ -38,5 +101,15 @@ void print_uint32_dec(uint32_t v);
 uint32_t pmm_get_total_frames(void);
 uint32_t pmm_get_used_frames(void);
 uint32_t pmm_get_free_frames(void);
+uint32_t pmm_get_cache_hits(void);      // single-frame requests served by a CPU cache
+uint32_t pmm_get_cache_misses(void);    // requests that had to refill from the buddy maps
+uint32_t pmm_get_zero_hits(void);       // zeroed-frame requests served from the pre-zeroed pool
+uint32_t pmm_get_zero_misses(void);     // zeroed-frame requests zeroed synchronously by the caller
+uint32_t pmm_get_zone_free(uint32_t zone);  // frames free in zone's buddy maps
+uint32_t pmm_get_color_count(void);     // page colours of the cache used for colouring (1 = none)
+
+#ifdef ORION_BENCH
+void pmm_bench(void);                   // boot-time allocation latency benchmark
+#endif
 
 #endif
@@ -20,6 +20,8 @@
 #define PROC_H
 
 #include "irq.h"
+#include "vmm.h"
+#include "ktimer.h"
 #include <stdint.h>
 #include <stddef.h>
 
@@ -37,12 +39,19 @@ typedef enum {
 } proc_state_t;
 
 // lower the number, higher the prio
+// 0 - 7  : real-time class, strict priority round-robin
+// 8 - 30 : fair class, priority = CPU share weight (each step ~1.25x)
+// 31     : idle
 #define PROC_PRIO_REALTIME   0              // hard real-time — never preempted by lower
 #define PROC_PRIO_HIGH       8              // interactive / high-priority system tasks
 #define PROC_PRIO_NORMAL    16              // default for all user processes
 #define PROC_PRIO_LOW       24              // background / batch work
 #define PROC_PRIO_IDLE      31              // idle thread only
 
+#define PROC_PRIO_FAIR_MIN  PROC_PRIO_HIGH          // first fair-class priority
+#define PROC_PRIO_FAIR_MAX  (PROC_PRIO_IDLE - 1)    // last fair-class priority
+#define PROC_PRIO_IS_FAIR(p) ((p) >= PROC_PRIO_FAIR_MIN && (p) <= PROC_PRIO_FAIR_MAX)
+
 #define PROC_PRIO_DEFAULT   PROC_PRIO_NORMAL
 
 // Default time quantum in PIT ticks
@@ -78,6 +87,8 @@ typedef struct pcb {
 
     // address space
     uint32_t       *page_directory;             // (NULL = kernel PD)
+    vmm_region_t   *regions;                    // demand-paged ranges (sorted, see proc_mmap)
+    uint32_t        minor_faults;               // faults resolved in memory (zero-fill, copy-on-write)
 
     // future scheduling
 
@@ -85,18 +96,31 @@ typedef struct pcb {
     uint8_t         priority;
     uint8_t         base_priority;
 
+    // scheduler - run queue (intrusive FIFO links, one queue per priority)
+    struct pcb     *rq_next;
+    struct pcb     *rq_prev;
+    uint8_t         on_rq;                      // 1 = queued (READY and not running)
+
+    // scheduler - fair class
+    uint64_t        vruntime;                   // weighted run time (ns at PROC_PRIO_NORMAL weight)
+    uint32_t        heap_idx;                   // slot in the vruntime min-heap while queued
+
     // scheduler - time-slice
     uint32_t        timeslice_len;
     uint32_t        timeslice;
 
-    // scheduler - accounting
-    uint32_t        ticks_total;
-    uint32_t        ticks_scheduled;
-    uint32_t        tick_last_run;
-    uint32_t        tick_created;
+    // scheduler - accounting (clock_ns() timestamps)
+    uint64_t        ns_total;                   // time spent running
+    uint32_t        ticks_scheduled;            // times switched in
+    uint64_t        ns_last_run;                // run time accounted up to here
+    uint64_t        ns_created;
+    uint64_t        ns_woken;                   // made READY by proc_wake (0 = not waiting for the CPU)
+    uint64_t        ns_wake_max;                // worst wake -> run latency
 
     // blocking / sleep
-    uint32_t        wakeup_tick;
+    uint32_t        wakeup_tick;                // deadline of the current sleep (0 = none)
+    uint64_t        wakeup_ns;                  // deadline of the current ns sleep (0 = none)
+    ktimer_t        sleep_timer;                // wakes the process at wakeup_tick / wakeup_ns
 
     // parent-child coordination
     pid_t           wait_for_pid;           // PID blocked waiting for (PID_INVALID = any child)
@@ -125,12 +149,19 @@ void   proc_set_timeslice(pcb_t *p, uint32_t ticks);
 void   proc_exit(int32_t exit_code);                            // running -> zombie
 pid_t  proc_wait(pid_t pid, int32_t *out_code);                 // running -> blocked -> destroy
 void   proc_sleep(uint32_t ticks);                              // running -> blocked (until proc_wake)
+void   proc_sleep_ns(uint64_t ns);                              // same, clock_ns() deadline (sub-tick precision)
 void   proc_wake(pcb_t *p);                                     // blocked -> ready
 
 pid_t  proc_fork(uint32_t child_entry);                         // new process (child of current)
+int    proc_mmap(pcb_t *p, uint32_t start, uint32_t length, uint32_t flags);    // lazy zero-filled user range
+int    proc_munmap(pcb_t *p, uint32_t start);                   // drop range added by proc_mmap + its pages
 int    proc_exec(pcb_t *p, uint32_t new_entry);                 // replace stopped process' excecution -> new entry point
 
 void   proc_dump(const pcb_t *p);                               // debugging
 void   proc_dump_all(void);
 
+#ifdef ORION_BENCH
+void   proc_fork_bench(void);                                   // boot-time fork storm: free frames before / at peak / after
+#endif
+
 #endif
\ No newline at end of file
@@ -1,4 +1,4 @@
-// sched.h - Round-robin priority scheduler
+// sched.h - Priority scheduler (real-time round-robin + fair vruntime class)
 
 #ifndef SCHED_H
 #define SCHED_H
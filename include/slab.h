@@ -0,0 +1,32 @@
+// Slab Allocator Header
+
+// object cache = fixed-size objects carved out of page-sized slabs
+// slab page = [ kmem_slab_t header ][ pad to align ][ obj 0 | link ][ obj 1 | link ] ...
+// free objects keep their constructed state: the free-list link sits in its own word after each object
+
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define KMEM_MAX_CACHES  32             // caches alive at once (static table)
+#define KMEM_MAX_OBJECT  512            // largest object size (at least 7 objects per 4KB slab)
+
+typedef struct kmem_cache kmem_cache_t;
+
+// create a cache of size-byte objects aligned to align (power of two, 0 = word)
+// ctor runs once per object when its slab is created (NULL = none), objects must be freed back in constructed state
+// name must outlive the cache, return NULL = table full / bad size or alignment
+kmem_cache_t *kmem_cache_create(const char *name, size_t size, size_t align, void (*ctor)(void *));
+
+// pop one object (NULL = out of memory)
+void *kmem_cache_alloc(kmem_cache_t *cache);
+
+// push object back onto its slab
+void kmem_cache_free(kmem_cache_t *cache, void *obj);
+
+// print usage statistics of every cache to serial
+void kmem_cache_dump(void);
+
+#endif
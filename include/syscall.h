@@ -14,8 +14,10 @@
 #define SYS_FORK        4       // EBX = child entry point  - spawn child process
 #define SYS_EXEC        5       // EBX = pid, ECX = entry   - replace process entry point
 #define SYS_WRITE       6       // EBX = const char *msg    - write string to VGA
+#define SYS_CLOCK       7       // EBX = uint64_t *ns       - monotonic nanoseconds since boot
+#define SYS_SLEEP_NS    8       // EBX:ECX = ns (low:high)  - sleep for N nanoseconds
 
-#define SYSCALL_COUNT   7
+#define SYSCALL_COUNT   9
 
 // kernel-side entry point (registered in IDT as int 0x80)
 void syscall_dispatch(regs_t *r);
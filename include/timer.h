@@ -8,8 +8,16 @@
 
 // I/O port addresses
 #define PIT_CHANNEL0 0x40       // system timer (channel 0)
+#define PIT_CHANNEL2 0x42       // speaker channel (gated, polled: TSC calibration)
+#define PIT_GATE     0x61       // port B: bit 0 = channel 2 gate, bit 1 = speaker, bit 5 = channel 2 output
 #define PIT_CMD 0x43            // command register
 
+// command bytes (channel 0, low byte -> high byte, binary counter)
+#define PIT_MODE_ONESHOT 0x30   // mode 0 = interrupt on terminal count (one-shot)
+#define PIT_MODE_RATE    0x34   // mode 2 = rate generator (periodic, counter readable)
+#define PIT_LATCH        0x00   // latch channel 0 count
+#define PIT_CH2_ONESHOT  0xB0   // channel 2, mode 0
+
 // Data ports
 #define PIT_BASE_FREQ 1193182   // oscillator port (frequency in Hz)
 
@@ -17,6 +25,18 @@ void timer_init(uint32_t hz);           // initialise PIT and install IRQ0 handl
 
 uint32_t timer_get_ticks(void);         // return tick counter since initialised
 
+void timer_set_tickless(int on);        // 1 = one-shot interrupts at the next ktimer deadline only, 0 = periodic ticks
+
+void timer_rearm(void);                 // timer set changed: re-pick periodic / one-shot and the next interrupt
+
+// clocksource: TSC calibrated against the PIT in timer_init (tick-based fallback without a TSC)
+uint64_t clock_cycles(void);            // raw TSC cycles (0 without a TSC)
+uint64_t clock_ns(void);                // monotonic nanoseconds since timer_init
+uint64_t clock_cycles_to_ns(uint64_t cycles);
+uint32_t clock_khz(void);               // calibrated TSC frequency (0 = none)
+
+void timer_stats(void);                 // print mode + interrupt counts to serial
+
 void timer_handler(regs_t *r);               // IRQ0 handler
 
 #endif
\ No newline at end of file
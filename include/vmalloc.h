@@ -0,0 +1,32 @@
+// vmalloc Header
+
+// vmalloc virtual address space = VMALLOC_START -> VMALLOC_END
+// area = [ pages backed by individually allocated (non-contiguous) frames ][ unmapped guard page ]
+// overrunning an area faults on its guard page instead of corrupting the next one
+
+#ifndef VMALLOC_H
+#define VMALLOC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// virtual address layout (kernel half, above the temp windows, below the page table window)
+#define VMALLOC_START 0xC6000000u
+#define VMALLOC_END   0xD6000000u       // 256MB of vmalloc space
+#define VMALLOC_GUARD 1u                // unmapped pages after every area
+
+// allocate size bytes (rounded up to pages), page aligned, virtually contiguous (NULL = no space / OOM)
+void *vmalloc(size_t size);
+
+// free pointer returned by vmalloc (frames back to the PMM)
+void vfree(void *ptr);
+
+// 1 = ptr lies in the vmalloc range (kfree hands such pointers to vfree)
+int vmalloc_owns(const void *ptr);
+
+size_t vmalloc_used(void);              // bytes mapped across all areas
+
+// print dump to serial
+void vmalloc_dump(void);
+
+#endif
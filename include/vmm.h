@@ -16,6 +16,9 @@
 #define VMM_NOCACHE (1u << 4)   // 000[1]0001 = disable caching            | 000[0]0001 = N/A
 #define VMM_ACCESSED (1u << 5)  // 00[1]00001 = CPU sets when read         | 00[0]00001 = N/A
 #define VMM_DIRTY (1u << 6)     // 0[1]000001 = CPU sets when write (PTE)  | 0[0]000001 = N/A
+#define VMM_LARGE (1u << 7)     // PDE only: entry maps a 4MB page directly (needs CR4.PSE)
+#define VMM_GLOBAL (1u << 8)    // kept in the TLB across CR3 loads (needs CR4.PGE)
+#define VMM_COW (1u << 9)       // software bit: read-only because the frame is shared copy-on-write
 
 // convenient combos
 #define VMM_KERNEL_RW   (VMM_PRESENT | VMM_WRITABLE)                    // Kernel read-write mapping
@@ -25,16 +28,126 @@
 // physical frame address = (page entries - flags)
 #define VMM_ADDR_MASK   0xFFFFF000u
 
+// page fault error code bits
+#define VMM_PF_PRESENT  (1u << 0)       // 1 = protection violation | 0 = page not present
+#define VMM_PF_WRITE    (1u << 1)       // 1 = write access
+#define VMM_PF_USER     (1u << 2)       // 1 = ring 3 access
+
+// 4MB page = one PDE, no page table (virtual and physical base aligned to 4MB = one PMM_MAX_ORDER block)
+#define VMM_LARGE_SIZE  0x00400000u
+#define VMM_LARGE_MASK  0xFFC00000u
+
+// higher-half layout: user space = [0, KERNEL_VIRT_BASE), kernel half = [KERNEL_VIRT_BASE, 4GB) (same page tables in every address space)
+//   KERNEL_VIRT_BASE + 0     : direct map of the DMA zone (first 16MB: kernel image at +2MB, VGA, page tables)
+//   HEAP_START .. HEAP_MAX   : kernel heap (kheap.h)
+//   VMM_TEMP_WINDOW          : scratch pages for frames outside the direct map (one per CPU)
+//   VMALLOC_START .. _END    : virtually contiguous allocations from scattered frames (vmalloc.h)
+//   KPAGE_START .. KPAGE_END : page-granular allocations - kernel stacks, slabs (kpage.h)
+//   VMM_PT_BASE .. 4GB       : page tables of the current address space (recursive PDE)
+#define KERNEL_VIRT_BASE 0xC0000000u
+
+// direct map conversions (only valid for physical addresses below PMM_DMA_LIMIT)
+#define P2V(phys) ((uint32_t)(phys) + KERNEL_VIRT_BASE)
+#define V2P(virt) ((uint32_t)(virt) - KERNEL_VIRT_BASE)
+
+// scratch virtual pages used to reach frames outside the direct map (just above the kernel heap ceiling)
+// CPU n uses VMM_TEMP_WINDOW + n * PAGE_SIZE
+#define VMM_TEMP_WINDOW 0xC5000000u
+
+// recursive mapping: the last PDE of every directory points at the directory itself,
+// so PTE of virt = ((uint32_t *)VMM_PT_BASE)[virt >> 12] and the directory sits at VMM_PD_VIRT
+#define VMM_RECURSIVE_PDE   1023u
+#define VMM_PT_BASE         0xFFC00000u
+#define VMM_PD_VIRT         0xFFFFF000u
+
+// batch operations (vmm_*_range): past this many changed pages, one full TLB flush replaces per-page invlpg
+#ifndef VMM_FLUSH_THRESHOLD
+#define VMM_FLUSH_THRESHOLD 32
+#endif
+
+#define VMM_MAX_SPACES  256                                             // address spaces alive at once (besides the kernel's)
+
 void vmm_init(void);
 
+// new address space: kernel half references the kernel's page tables, user half empty (NULL on OOM)
+uint32_t *vmm_create_address_space(void);
+
+// free an address space, its user page tables and its references to the frames they map
+void vmm_destroy_address_space(uint32_t *pd);
+
+// copy of the current address space: user frames shared copy-on-write (NULL on OOM)
+uint32_t *vmm_clone_address_space(void);
+
+// virtual memory region: user range backed on first touch by zeroed frames (demand paging)
+typedef struct vmm_region {
+    uint32_t           start;           // first byte (page aligned)
+    uint32_t           end;             // byte past the region (page aligned)
+    uint32_t           flags;           // PTE flags of pages faulted in
+    struct vmm_region *next;            // list sorted by start
+} vmm_region_t;
+
+// add [start, start + length) to a region list (page aligned start, user half, no overlap): 0 = added, -1 = rejected / OOM
+int vmm_region_add(vmm_region_t **list, uint32_t start, uint32_t length, uint32_t flags);
+
+// region containing addr (NULL = none)
+vmm_region_t *vmm_region_find(vmm_region_t *list, uint32_t addr);
+
+// remove the region starting at start and release pd's pages inside it: 0 = removed, -1 = no such region
+int vmm_region_remove(vmm_region_t **list, uint32_t *pd, uint32_t start);
+
+// duplicate a region list (fork): 0 = copied, -1 = OOM
+int vmm_region_clone(vmm_region_t **dst, const vmm_region_t *src);
+
+// free every node of a region list (pages go with the address space)
+void vmm_region_free_all(vmm_region_t **list);
+
+// unmap pd's user pages in [start, end) and drop its references to their frames (NULL = kernel directory)
+void vmm_release_range(uint32_t *pd, uint32_t start, uint32_t end);
+
+// page fault hook: 0 = fault resolved (demand zero-fill inside regions, copy-on-write), -1 = genuine fault
+int vmm_handle_fault(uint32_t addr, uint32_t err, vmm_region_t *regions);
+
+// make pd the current address space (NULL = kernel), CR3 reloaded only when it changes
+void vmm_switch(uint32_t *pd);
+
 void vmm_map_page(uint32_t virt, uint32_t phys, uint32_t flags);
+int  vmm_try_map_page(uint32_t virt, uint32_t phys, uint32_t flags);      // 0 = mapped, -1 = page table allocation failed
 
+// range operations on the current address space: each page table walked once, TLB invalidated once at the end
 void vmm_map_range(uint32_t virt, uint32_t phys, uint32_t length, uint32_t flags);
 
+void vmm_unmap_range(uint32_t virt, uint32_t length);
+
+// kernel-half counterpart of vmm_release_range: unmap a range of owned pages and free their frames in one walk
+// (unmapped pages skipped, 4MB pages untouched), return pages freed
+uint32_t vmm_free_range(uint32_t virt, uint32_t length);
+
+// new flags for the mapped pages of a range (copy-on-write pages stay read-only until their fault)
+void vmm_protect_range(uint32_t virt, uint32_t length, uint32_t flags);
+
 void vmm_unmap_page(uint32_t virt);
 
+// map 4MB kernel-half page (virt, phys 4MB aligned, PDE unused): 0 = mapped, -1 = caller falls back to 4KB pages
+int vmm_map_large(uint32_t virt, uint32_t phys, uint32_t flags);
+
+// remove 4MB page mapping (frames stay with the caller)
+void vmm_unmap_large(uint32_t virt);
+
+// 1 = CR4.PSE on, vmm_map_large can succeed
+int vmm_has_large_pages(void);
+
+// back virtual page with a new frame of the page's colour, return the frame (0 = out of memory)
+uint32_t vmm_alloc_page(uint32_t virt, uint32_t flags);
+
 uint32_t vmm_get_phys(uint32_t virt);
 
 int vmm_is_mapped(uint32_t virt);
 
+// zero one physical frame (direct map for DMA frames, this CPU's temp window otherwise)
+void vmm_zero_frame(uint32_t phys);
+
+#ifdef ORION_BENCH
+void vmm_bench(void);                   // boot-time address space switch benchmark
+#endif
+
 #endif
\ No newline at end of file
@@ -5,6 +5,9 @@ MAGIC     equ 0x1BADB002
 FLAGS     equ (1<<0) | (1<<1)
 CHECKSUM  equ -(MAGIC + FLAGS)
 
+KERNEL_VIRT_BASE equ 0xC0000000				; kernel linked here (linker.ld), loaded at physical 2MB
+BOOT_TABLES      equ 4						; boot page tables = first 16MB
+
 section .multiboot
 	align 4
 	dd MAGIC
@@ -12,6 +15,12 @@ section .multiboot
 	dd CHECKSUM
 
 section .bss
+	align 4096
+	boot_page_directory:
+	resb 4096
+	boot_page_tables:
+	resb 4096 * BOOT_TABLES
+
 	align 16
 	stack_bottom:
 	resb 16384
@@ -21,12 +30,47 @@ section .text
 	global _start
 	extern kernel_main
 
-_start:
+_start equ (start - KERNEL_VIRT_BASE)		; GRUB jumps here with paging off = physical entry point
+
+; eax = multiboot magic, ebx = multiboot_info_t (physical) - both kept for kernel_main
+start:
+    ; boot page tables: entry i = (i * 4KB) | present | writable
+    mov edi, boot_page_tables - KERNEL_VIRT_BASE
+    mov edx, 0x003
+    mov ecx, 1024 * BOOT_TABLES
+.fill_tables:
+    mov [edi], edx
+    add edx, 4096
+    add edi, 4
+    loop .fill_tables
+
+    ; install each table twice: identity (keeps the next instructions mapped) + higher half
+    mov edi, boot_page_directory - KERNEL_VIRT_BASE
+    mov edx, (boot_page_tables - KERNEL_VIRT_BASE) + 0x003
+    xor ecx, ecx
+.fill_directory:
+    mov [edi + ecx * 4], edx
+    mov [edi + ecx * 4 + (KERNEL_VIRT_BASE >> 22) * 4], edx
+    add edx, 4096
+    inc ecx
+    cmp ecx, BOOT_TABLES
+    jne .fill_directory
+
+    mov ecx, boot_page_directory - KERNEL_VIRT_BASE
+    mov cr3, ecx            ; (tell cpu where page tables live)
+    mov ecx, cr0
+    or ecx, 0x80010000      ; (paging bit 31 + write protect bit 16: ring 0 honours read-only pages = copy-on-write)
+    mov cr0, ecx
+
+    lea ecx, [.higher_half] ; absolute jump -> virtual addresses from here on
+    jmp ecx
+
+.higher_half:
     mov esp, stack_top
-	push ebx				; multiboot_info_t
+	push ebx				; multiboot_info_t (physical - kernel_main converts)
 	push eax				; magic
     call kernel_main
     cli
 .hang:
     hlt
-    jmp .hang
\ No newline at end of file
+    jmp .hang
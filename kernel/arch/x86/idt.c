@@ -3,6 +3,8 @@
 #include "kprintf.h"
 #include "panic.h"
 #include "syscall.h"
+#include "vmm.h"
+#include "sched.h"
 
 extern void syscall_entry(void);        // syscall.asm
 
@@ -98,6 +100,17 @@ void idt_init(void) {                       //initialize idt
 // C exception handler
 void isr_handler(regs_t *r) {
 
+    if (r->int_no == 14) {                                      // page fault: demand paging / copy-on-write first
+        uint32_t fault_addr;
+        asm volatile ("mov %%cr2, %0" : "=r"(fault_addr));
+
+        pcb_t *p = sched_current();
+        if (vmm_handle_fault(fault_addr, r->err_code, p ? p->regions : 0) == 0) {
+            if (p) p->minor_faults++;
+            return;                                             // retry the faulting instruction
+        }
+    }
+
     kprintf("\n=== CPU EXCEPTION ===\n");
 
     switch (r->int_no) {
@@ -1,21 +1,26 @@
 [bits 32]
 
-; eax = phys address of page directory
-; cr0 = 32-bit control register = master switch which holds CPU control flags
+; cr0 = 32-bit control register = master switch which holds CPU control flags (paging turned on by boot.asm)
 ; cr3 = 32-bit control register = CPU store of phys address of page directory
-; paging_bit (paging enabled) = (bit 31) = 0x80000000
+; cr4 = 32-bit control register = extension flags (bit 7 = PGE global pages)
 
-global enable_paging
 global tlb_flush_page
+global switch_page_directory
+global get_cr4
+global set_cr4
 
 tlb_flush_page:
     mov eax, [esp+4]    ; get virt address argument
     invlpg [eax]        ; flush that page from TLB
     ret
-enable_paging:
+switch_page_directory:
     mov eax, [esp + 4]
-    mov cr3, eax        ; (tell cpu where page tables live)
-    mov eax, cr0        ; (read control flags into eax)
-    or eax, 0x80000000  ; (set bits 31 to cr0 without changing other bits)
-    mov cr0, eax        ; (write changed value back to cr0)
-    ret
\ No newline at end of file
+    mov cr3, eax        ; (new address space - flushes every non-global TLB entry)
+    ret
+get_cr4:
+    mov eax, cr4
+    ret
+set_cr4:
+    mov eax, [esp + 4]
+    mov cr4, eax        ; (toggling PGE flushes the whole TLB, global entries included)
+    ret
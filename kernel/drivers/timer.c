@@ -1,36 +1,284 @@
 #include "timer.h"
+#include "clockevent.h"
 #include "ioport.h"
 #include "irq.h"
 #include "sched.h"
+#include "ktimer.h"
 #include "serial.h"
+#include "kprintf.h"
+#include "cpu.h"
+
+// PIT clockevent: channel 0, rate generator (mode 2) for the periodic tick, interrupt on terminal count (mode 0) for one-shots
+// (mode 2 instead of square wave: the counter then counts down by 1 and can be read back for partial-tick accounting)
+
+static void pit_load(uint8_t mode_cmd, uint32_t delta) {
+
+    if (delta == 0) delta = 1;                              // clamp range 1 - 65535
+    if (delta > 0xFFFF) delta = 0xFFFF;                     // PIT quirk = (divisor = 0  -> interpreted as 65536)
+
+    outb(PIT_CMD, mode_cmd);
+    outb(PIT_CHANNEL0, (uint8_t)(delta & 0xFF));            // low byte value
+    outb(PIT_CHANNEL0, (uint8_t)((delta >> 8) & 0xFF));     // high byte value
+}
+
+static void pit_set_periodic(uint32_t delta) {
+    pit_load(PIT_MODE_RATE, delta);
+}
+
+static void pit_set_oneshot(uint32_t delta) {
+    pit_load(PIT_MODE_ONESHOT, delta);
+}
+
+static uint32_t pit_remaining(void) {
+
+    outb(PIT_CMD, PIT_LATCH);                               // freeze channel 0 count for reading
+    uint32_t lo = inb(PIT_CHANNEL0);
+    uint32_t hi = inb(PIT_CHANNEL0);
+    return (hi << 8) | lo;
+}
+
+static const clockevent_t pit_clockevent = {
+    .name         = "PIT",
+    .freq         = PIT_BASE_FREQ,
+    .max_delta    = 0xFFFF,
+    .set_periodic = pit_set_periodic,
+    .set_oneshot  = pit_set_oneshot,
+    .remaining    = pit_remaining,
+};
+
+static const clockevent_t *ce = &pit_clockevent;
+
+// TSC clocksource: ns = cycles * mult >> CLOCK_SHIFT (split into 32-bit halves: no 96-bit product)
+#define CLOCK_SHIFT     22
+#define CLOCK_CAL_MS    50                          // calibration window
+#define CPUID_EDX_TSC   (1u << 4)
+
+static uint32_t tsc_khz  = 0;                       // 0 = no TSC: clock_ns() counts ticks
+static uint32_t tsc_mult = 0;
+static uint64_t tsc_base = 0;                       // TSC at calibration = clock 0
+static uint32_t tick_ns  = 0;                       // fallback resolution
 
 static volatile uint32_t tick_count = 0;
 
+static uint32_t tick_delta   = 0;                   // counter units per tick
+static uint32_t delta_accum  = 0;                   // units elapsed but not yet a whole tick
+static uint32_t armed_delta  = 0;                   // units of the pending one-shot (0 = periodic / none)
+static int      tickless     = 0;                   // 1 = scheduler needs no periodic ticks (idle / single task)
+static int      oneshot      = 0;                   // 1 = device in one-shot mode (tickless, or ns timers pending)
+static int      in_handler   = 0;                   // timer_handler picks the next interrupt itself
+
+static uint32_t irq_periodic = 0;                   // timer interrupts taken in each mode
+static uint32_t irq_oneshot  = 0;
+
+// turn elapsed counter units into whole ticks
+static void tick_advance(uint32_t delta) {
+    delta_accum += delta;
+    tick_count  += delta_accum / tick_delta;
+    delta_accum %= tick_delta;
+}
+
+// counter units until clock_ns() reaches deadline (rounded up, >= 1), capped at max
+static uint32_t ns_to_delta(uint64_t deadline, uint32_t max) {
+
+    uint64_t now = clock_ns();
+    if (deadline <= now) return 1;
+
+    uint64_t left = deadline - now;
+    if (left >= 1000000000ull) return max;                  // beyond any one-shot: no overflow below
+
+    uint64_t units = (left * ce->freq + 999999999ull) / 1000000000ull;
+    if (units == 0) return 1;
+    return units < max ? (uint32_t)units : max;
+}
+
+// program the one-shot for the next event (at most max_delta away):
+//   the next tick boundary (ticks still needed) or the next wheel deadline (tickless),
+//   or an earlier nanosecond timer, armed to the exact counter unit
+static void tick_program_next(void) {
+
+    uint32_t max_ticks = ce->max_delta / tick_delta;
+    if (max_ticks == 0) max_ticks = 1;
+
+    uint32_t ticks = tickless ? ktimer_next_due(tick_count, max_ticks) : 1;
+    uint32_t delta = ticks * tick_delta - delta_accum;
+
+    uint64_t ns = ktimer_next_ns();
+    if (ns)
+        delta = ns_to_delta(ns, delta);
+
+    armed_delta = delta;
+    ce->set_oneshot(armed_delta);
+}
+
+// units of the pending one-shot already run (counter past terminal count = all of it)
+static uint32_t oneshot_elapsed(void) {
+    uint32_t left = ce->remaining();
+    return left <= armed_delta ? armed_delta - left : armed_delta;
+}
+
 // timer fires = timer_handler()
 void timer_handler(regs_t *r) {
     (void)r;                                    // pass CPU register state (future dev)
-    tick_count++;
-    sched_tick();
+
+    uint32_t before = tick_count;
+    in_handler = 1;
+
+    if (armed_delta) {                          // one-shot expired: its whole delay has elapsed
+        tick_advance(armed_delta);
+        armed_delta = 0;
+        irq_oneshot++;
+    } else {
+        tick_advance(tick_delta);
+        irq_periodic++;
+    }
+
+    ktimer_run(tick_count);                     // expired sleeps / timeouts (may wake tasks -> periodic again)
+    uint32_t fired = ktimer_run_ns(clock_ns()); // nanosecond deadlines
+
+    if (tick_count != before || fired)          // mid-tick interrupt with nothing woken: no scheduling point
+        sched_tick();
+
+    in_handler = 0;
+
+    if (tickless || ktimer_next_ns()) {         // next interrupt = next event only
+        oneshot = 1;
+        tick_program_next();
+    } else if (oneshot) {                       // competing tasks, no ns timers: back to periodic ticks
+        oneshot = 0;
+        ce->set_periodic(tick_delta);
+    }
 }
 
 uint32_t timer_get_ticks(void) {
-    return tick_count;
+
+    if (!oneshot) return tick_count;
+
+    uint32_t flags = cpu_irq_save();                            // one-shot mode: count the ticks run since it was armed
+    uint32_t ticks = tick_count + (delta_accum + oneshot_elapsed()) / tick_delta;
+    cpu_irq_restore(flags);
+    return ticks;
+}
+
+// re-pick the device mode and the next interrupt after tickless / the timer set changed
+// one-shot while the scheduler is tickless or a ns timer is pending, periodic otherwise
+void timer_rearm(void) {
+
+    if (!tick_delta) return;
+
+    uint32_t flags = cpu_irq_save();
+
+    if (in_handler) {                                           // timer_handler re-programs on its way out
+        cpu_irq_restore(flags);
+        return;
+    }
+
+    int want = tickless || ktimer_next_ns() != 0;
+
+    if (oneshot) {                                              // stop the pending one-shot: account what ran of it
+        tick_advance(oneshot_elapsed());
+        armed_delta = 0;
+    } else if (want) {                                          // periodic -> one-shot: keep the part of the tick already run
+        uint32_t left = ce->remaining();
+        if (left <= tick_delta)
+            tick_advance(tick_delta - left);
+    } else {                                                    // periodic and staying so
+        cpu_irq_restore(flags);
+        return;
+    }
+
+    oneshot = want;
+    if (want)
+        tick_program_next();
+    else
+        ce->set_periodic(tick_delta);
+
+    cpu_irq_restore(flags);
+}
+
+// switch between periodic ticks (tasks compete for the CPU) and one-shot deadlines (idle / single task)
+void timer_set_tickless(int on) {
+
+    if (!tick_delta || on == tickless) return;
+
+    tickless = on;
+    timer_rearm();
+}
+
+void timer_stats(void) {
+    kprintf("Timer: %s  ticks=%u  mode=%s  irqs periodic=%u one-shot=%u  uptime=%u ms\n",
+            ce->name, tick_count, oneshot ? "one-shot" : "periodic", irq_periodic, irq_oneshot,
+            (uint32_t)(clock_ns() / 1000000u));
+}
+
+// count TSC cycles across a fixed PIT channel 2 countdown (no IRQ involved, channel 0 untouched)
+static uint32_t tsc_calibrate(void) {
+
+    uint32_t a, b, c, d;
+    cpu_cpuid(1, 0, &a, &b, &c, &d);
+    if (!(d & CPUID_EDX_TSC)) return 0;
+
+    uint32_t count = PIT_BASE_FREQ / (1000 / CLOCK_CAL_MS);
+    uint8_t  gate  = inb(PIT_GATE);
+
+    outb(PIT_GATE, (uint8_t)((gate & ~0x02) | 0x01));        // gate on, speaker off
+    outb(PIT_CMD, PIT_CH2_ONESHOT);
+    outb(PIT_CHANNEL2, (uint8_t)(count & 0xFF));
+    outb(PIT_CHANNEL2, (uint8_t)((count >> 8) & 0xFF));     // counting starts here
+
+    uint64_t t0 = rdtsc();
+    while (!(inb(PIT_GATE) & 0x20))                         // output goes high at terminal count
+        ;
+    uint64_t t1 = rdtsc();
+
+    outb(PIT_GATE, gate);
+    return (uint32_t)((t1 - t0) / CLOCK_CAL_MS);
+}
+
+uint64_t clock_cycles(void) {
+    return tsc_khz ? rdtsc() : 0;
+}
+
+uint64_t clock_cycles_to_ns(uint64_t cycles) {
+
+    uint32_t lo = (uint32_t)cycles;
+    uint32_t hi = (uint32_t)(cycles >> 32);
+
+    return (((uint64_t)lo * tsc_mult) >> CLOCK_SHIFT)
+         + (((uint64_t)hi * tsc_mult) << (32 - CLOCK_SHIFT));
+}
+
+uint64_t clock_ns(void) {
+
+    if (!tsc_khz)
+        return (uint64_t)timer_get_ticks() * tick_ns;
+
+    return clock_cycles_to_ns(rdtsc() - tsc_base);
+}
+
+uint32_t clock_khz(void) {
+    return tsc_khz;
 }
 
 // interrupt at wanted frequency
 void timer_init(uint32_t hz) {
 
-    // divisor = reload value
-    uint32_t divisor = PIT_BASE_FREQ / hz;                  // divisor = 1193182 / desired frequency
-    if (divisor == 0) divisor = 1;                          // clamp range 1 - 65535
-    if (divisor > 0xFFFF) divisor = 0xFFFF;                 // PIT quirk = (divisor = 0  -> interpreted as 65536)
+    // delta = reload value
+    tick_delta = ce->freq / hz;                             // divisor = 1193182 / desired frequency
+    if (tick_delta == 0) tick_delta = 1;
+    if (tick_delta > ce->max_delta) tick_delta = ce->max_delta;
 
-    // PIT configuration
-    outb(PIT_CMD, 0x36);                                    // | channel 0 | access = low byte -> high byte | square wave | binary counter |
+    tick_ns = 1000000000u / hz;
+    tsc_khz = tsc_calibrate();                              // before IRQ0 runs: nothing else touches the PIT
+    if (tsc_khz) {
+        tsc_mult = (uint32_t)((1000000ull << CLOCK_SHIFT) / tsc_khz);
+        tsc_base = rdtsc();
+        kprintf("Timer: TSC clocksource %u kHz (%u ns / 1024 cycles)\n",
+                tsc_khz, (uint32_t)clock_cycles_to_ns(1024));
+    } else {
+        kprintf("Timer: no TSC, clock_ns() at tick resolution\n");
+    }
 
-    // send reload value
-    outb(PIT_CHANNEL0, (uint8_t)(divisor & 0xFF));          // low byte value
-    outb(PIT_CHANNEL0, (uint8_t)((divisor >> 8) & 0xFF));   // high byte value
+    ce->set_periodic(tick_delta);                           // periodic until the scheduler reports no contention
 
     irq_install_handler(0, timer_handler);                  // install IRQ handler (connect IRQ0 -> timer handler)
 
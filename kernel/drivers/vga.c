@@ -2,10 +2,11 @@
 
 #include "vga.h"
 #include "string.h"
+#include "vmm.h"
 
 #define VGA_WIDTH   80
 #define VGA_HEIGHT  25
-#define VGA_MEMORY  0xB8000
+#define VGA_MEMORY  P2V(0xB8000)        // text buffer through the higher-half direct map
 
 static size_t    terminal_row;
 static size_t    terminal_col;
@@ -46,12 +46,24 @@ void kernel_main(uint32_t multiboot_magic, multiboot_info_t *mbi) {
 
     kassert(multiboot_magic == MULTIBOOT_MAGIC);
 
-    pmm_init(mbi, (uint32_t)(uintptr_t)&kernel_start, (uint32_t)(uintptr_t)&kernel_end);
+    mbi = (multiboot_info_t *)P2V((uint32_t)(uintptr_t)mbi);                     // GRUB passes a physical pointer (low memory = direct map)
+
+    pmm_init(mbi, V2P(&kernel_start), V2P(&kernel_end));                        // linker symbols are higher-half addresses
     vmm_init();
     kheap_init();
 
+#ifdef ORION_BENCH
+    pmm_bench();
+    vmm_bench();
+    kheap_bench();
+#endif
+
     proc_init();
 
+#ifdef ORION_BENCH
+    proc_fork_bench();
+#endif
+
     syscall_init();
     idt_install_syscall();
 
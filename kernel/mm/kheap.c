@@ -1,14 +1,17 @@
 // Kernel Heap
 
-// algorithm: first-fit search | immediate coalescing on free
+// algorithm: segregated fits (first fit inside a size class) | immediate coalescing on free
 
-// (boundary-tag) (implicit) (free list)
+// (boundary-tag) (explicit) (segregated free lists)
 
 // block Anatomy:
 // header (4 bytes) = size | alloc_bit
 // payload (variable size)
 // footer (4 bytes) = size | alloc_bit
 
+// free block payload = [ pred (4 B) ][ succ (4 B) ] ... links of its size class list (MIN_BLOCK leaves exactly room for both)
+// class c holds free blocks of [16 << c, 32 << c) bytes, the last class everything larger
+
 // heap memory map (virtual):
 //   HEAP_START + 0 : alignment padding  (4 B, value = 0)
 //   HEAP_START + 4 : prologue header    (8 | ALLOC)
@@ -20,11 +23,13 @@
 // lazy page mapping
 
 #include "kheap.h"
+#include "vmalloc.h"
 #include "vmm.h"
 #include "pmm.h"
 
 #include "kprintf.h"
 #include "panic.h"
+#include "cpu.h"
 
 #define WSIZE 4u                            // word = header/footer size (bytes)
 #define DWSIZE 8u                           // double word - alignment unit
@@ -61,14 +66,54 @@
 // bp of the previous block
 #define PREV_BLKP(bp)   ((char *)(bp) - GET_SIZE((char *)(bp) - DWSIZE))    // uses the previous block's footer ( O(1) backwards traversal )
 
+// FREE LIST MACROS
+
+// bp of the previous / next free block in the same class list (0 = none)
+#define GET_PRED(bp)        ((char *)GET(bp))
+#define GET_SUCC(bp)        ((char *)GET((char *)(bp) + WSIZE))
+#define SET_PRED(bp, p)     PUT((bp), (uint32_t)(p))
+#define SET_SUCC(bp, p)     PUT((char *)(bp) + WSIZE, (uint32_t)(p))
+
+#define KHEAP_CLASSES   16u                 // 16 B .. 512 KB+ (class 15 = catch-all)
+
 // HEAP
 
+static char     *free_lists[KHEAP_CLASSES]; // head bp of each class (LIFO)
+
 static char     *heap_listp = 0;            // bp of prologue - NEXT_BLKP(heap_listp) = first real block (skipping prologue)
 static uint32_t heap_brk   = 0;             // byte address of epilogue header
 static uint32_t heap_virt_mapped = 0;       // highest virtual byte mapped (prevent writing in unmapped memory)
 
+static uint32_t heap_large_pages = 0;       // 4MB regions mapped with one PDE
+static uint32_t heap_large_map   = 0;       // bit i = [HEAP_START + i * 4MB] is one 4MB page (HEAP_MAX - HEAP_START <= 32 x 4MB)
+static uint32_t heap_trimmed     = 0;       // pages given back to the PMM by trim
+
+#define LARGE_BIT(virt)  (1u << (((virt) - HEAP_START) / VMM_LARGE_SIZE))
+
+// back the next 4MB of heap with one large page: only at a 4MB boundary once the heap has outgrown its first 4MB
+// return 1 = mapped, 0 = caller maps 4KB pages (no PSE, no free 4MB block, ceiling)
+static int map_large(void) {
+
+    if (!vmm_has_large_pages()) return 0;
+    if (heap_virt_mapped % VMM_LARGE_SIZE || heap_virt_mapped == HEAP_START) return 0;
+    if (heap_virt_mapped + VMM_LARGE_SIZE > HEAP_MAX) return 0;
+
+    uint32_t phys = pmm_alloc_frames(PMM_MAX_ORDER);                            // max-order block = 4MB aligned
+    if (!phys) return 0;
+
+    if (vmm_map_large(heap_virt_mapped, phys, VMM_KERNEL_RW) != 0) {
+        pmm_free_frames(phys, PMM_MAX_ORDER);
+        return 0;
+    }
+
+    heap_large_map |= LARGE_BIT(heap_virt_mapped);
+    heap_virt_mapped += VMM_LARGE_SIZE;
+    heap_large_pages++;
+    return 1;
+}
+
 // ensure virtual addresses [HEAP_START, end) are backed by physical pages
-// maps new pages from PMM on demand.  return 0 on success, -1 on OOM
+// maps new pages from PMM on demand (4MB pages where possible).  return 0 on success, -1 on OOM
 static int ensure_mapped(uint32_t end) {
 
     while (heap_virt_mapped < end) {
@@ -78,22 +123,134 @@ static int ensure_mapped(uint32_t end) {
             return -1;
         }
 
-        uint32_t phys = pmm_alloc_frame();
+        if (map_large()) continue;
 
-        if (!phys) {
+        if (!vmm_alloc_page(heap_virt_mapped, VMM_KERNEL_RW)) {                     // frame coloured to its heap page
             kprintf("KHEAP: FATAL — PMM out of physical frames\n");                // out of physical memory
             return -1;
         }
 
-        vmm_map_page(heap_virt_mapped, phys, VMM_KERNEL_RW);
         heap_virt_mapped += PAGE_SIZE;
     }
 
     return 0;
 }
 
+// size class of a block size: floor(log2(size)) - 4, capped at the last class
+static inline uint32_t size_class(size_t size) {
+
+    uint32_t c = 31u - (uint32_t)__builtin_clz((uint32_t)size) - 4u;           // size >= MIN_BLOCK = 16 = 1 << 4
+    return (c < KHEAP_CLASSES) ? c : KHEAP_CLASSES - 1u;
+}
+
+// push free block onto the head of its class list
+static void list_insert(char *bp) {
+
+    uint32_t c = size_class(GET_SIZE(HDRP(bp)));
+
+    SET_PRED(bp, 0);
+    SET_SUCC(bp, free_lists[c]);
+    if (free_lists[c])
+        SET_PRED(free_lists[c], bp);
+    free_lists[c] = bp;
+}
+
+// unlink free block from its class list (its size must still be the one it was inserted with)
+static void list_remove(char *bp) {
+
+    char *pred = GET_PRED(bp);
+    char *succ = GET_SUCC(bp);
+
+    if (pred) SET_SUCC(pred, succ);
+    else      free_lists[size_class(GET_SIZE(HDRP(bp)))] = succ;
+
+    if (succ) SET_PRED(succ, pred);
+}
+
+// first block that fits asize: first fit inside its own class, any block of a larger class fits whole
+static char *find_fit(size_t asize) {
+
+    uint32_t c = size_class(asize);
+
+    for (char *bp = free_lists[c]; bp; bp = GET_SUCC(bp))
+        if (GET_SIZE(HDRP(bp)) >= asize)
+            return bp;
+
+    for (c++; c < KHEAP_CLASSES; c++)
+        if (free_lists[c])
+            return free_lists[c];
+
+    return 0;
+}
+
+// unmap heap pages from the top down to target (4MB pages only as a whole), frames back to the PMM
+// return pages released (heap_virt_mapped may stay above target: a 4MB page straddling it is kept)
+static uint32_t unmap_tail(uint32_t target) {
+
+    uint32_t pages   = 0;
+    uint32_t run_end = heap_virt_mapped;                                        // top of the pending 4KB run
+
+    while (heap_virt_mapped > target) {
+
+        uint32_t region = HEAP_START + ((heap_virt_mapped - 1u - HEAP_START) & VMM_LARGE_MASK);
+
+        if (heap_large_map & LARGE_BIT(region)) {
+
+            if (region < target) break;                                         // still partly needed
+
+            vmm_free_range(heap_virt_mapped, run_end - heap_virt_mapped);       // 4KB pages above it first
+
+            uint32_t phys = vmm_get_phys(region);
+            vmm_unmap_large(region);
+            pmm_free_frames(phys, PMM_MAX_ORDER);
+
+            heap_large_map &= ~LARGE_BIT(region);
+            heap_large_pages--;
+            heap_virt_mapped = run_end = region;
+            pages += VMM_LARGE_SIZE / PAGE_SIZE;
+            continue;
+        }
+
+        heap_virt_mapped -= PAGE_SIZE;                                          // 4KB page: joins the pending run
+        pages++;
+    }
+
+    vmm_free_range(heap_virt_mapped, run_end - heap_virt_mapped);               // one walk + TLB flush for the run
+    return pages;
+}
+
+// shrink free block bp at the end of the heap: release pages above KHEAP_TRIM_KEEP bytes of it, move the epilogue down
+static void trim(char *bp) {
+
+    uint32_t block  = (uint32_t)HDRP(bp);
+    uint32_t target = (block + KHEAP_TRIM_KEEP + WSIZE + PAGE_SIZE - 1u) & ~(PAGE_SIZE - 1u);   // keep block + epilogue word mapped
+
+    if (target >= heap_virt_mapped) return;
+
+    uint32_t flags = cpu_irq_save();                                            // heap shrinks as one step: no kmalloc may see a half-trimmed tail
+
+    heap_trimmed += unmap_tail(target);
+
+    uint32_t brk = heap_virt_mapped - WSIZE;                                    // free block now ends at the last mapped word
+    if (brk < heap_brk) {
+
+        list_remove(bp);                                                        // class may change with the size
+
+        size_t size = brk - block;
+        PUT(HDRP(bp), PACK(size, 0));
+        PUT(FTRP(bp), PACK(size, 0));
+        PUT((char *)brk, PACK(0, 1));                                           // new epilogue
+
+        heap_brk = brk;
+        list_insert(bp);
+    }
+
+    cpu_irq_restore(flags);
+}
+
 // Merge bp with any immediately adjacent free blocks
 // Uses boundary tags so each direction is O(1)
+// bp is free but on no list: free neighbours leave their lists, the merged block joins its class list
 // Returns the bp of the (possibly enlarged) free block
 static char *coalesce(char *bp) {
 
@@ -107,28 +264,35 @@ static char *coalesce(char *bp) {
 
     if (!prev_free && !next_free) {
 
-        return bp;                                                  // case 1: both neighbours allocated (nothing to merge)
+        list_insert(bp);                                            // case 1: both neighbours allocated (nothing to merge)
+        return bp;
 
     } else if (!prev_free && next_free) {
-        
+
+        list_remove(next_bp);
         size += GET_SIZE(HDRP(next_bp));                            // case 2: only next block is free (absorb it)
         PUT(HDRP(bp),   PACK(size, 0));
         PUT(FTRP(bp),   PACK(size, 0));                 // FTRP recalculates with new size
 
     } else if (prev_free && !next_free) {
-        
+
+        list_remove(prev_bp);
         size += GET_SIZE(HDRP(prev_bp));                // case 3: only prev block is free (merge into it)
         PUT(FTRP(bp),      PACK(size, 0));              // write footer at current bp's end
         PUT(HDRP(prev_bp), PACK(size, 0));              // update prev blocks header
         bp = prev_bp;                                   // return starts at merged block
 
     } else {
-        
+
+        list_remove(prev_bp);
+        list_remove(next_bp);
         size += GET_SIZE(HDRP(prev_bp)) + GET_SIZE(HDRP(next_bp));  // case 4: both neighbours are free (three-way merge)
         PUT(HDRP(prev_bp), PACK(size, 0));
         PUT(FTRP(next_bp), PACK(size, 0));
         bp = prev_bp;
     }
+
+    list_insert(bp);
     return bp;
 }
 
@@ -153,12 +317,14 @@ static char *extend_heap(size_t size) {
     return coalesce(bp);                                            // coalesce if (block before old epilogue was free)
 }
 
-// place allocation of 'asize' bytes -> free block at bp
-// splits block if (remainder fits minimum-sized free block)
+// place allocation of 'asize' bytes -> free block at bp (taken off its list)
+// splits block if (remainder fits minimum-sized free block), remainder goes on its class list
 static void place(char *bp, size_t asize) {
 
     size_t csize = GET_SIZE(HDRP(bp));                              // read block size
 
+    list_remove(bp);
+
     if (csize - asize >= MIN_BLOCK) {                               // if remainder is big enough (16 bytes)
         
         PUT(HDRP(bp), PACK(asize, 1));                              // split: allocate front, leave rear as free block
@@ -167,6 +333,7 @@ static void place(char *bp, size_t asize) {
         char *remainder = NEXT_BLKP(bp);
         PUT(HDRP(remainder), PACK(csize - asize, 0));
         PUT(FTRP(remainder), PACK(csize - asize, 0));
+        list_insert(remainder);                                     // neighbours are allocated: no coalescing needed
 
     } else {
         
@@ -180,11 +347,9 @@ void kheap_init(void) {
 
     kprintf("KHEAP: Initialising kernel heap\n");
 
-    uint32_t phys = pmm_alloc_frame();                                          // physical frame from PMM
-    if (!phys)
+    if (!vmm_alloc_page(HEAP_START, VMM_KERNEL_RW))                             // map first page (physical frame from PMM)
         panic("KHEAP: init — cannot allocate first heap page from PMM");
 
-    vmm_map_page(HEAP_START, phys, VMM_KERNEL_RW);                              // map first page
     heap_virt_mapped = HEAP_START + PAGE_SIZE;
 
     char *base = (char *)HEAP_START;
@@ -218,17 +383,16 @@ void *kmalloc(size_t size) {
 
     if (!size) return 0;                                                // defensive reject 0 size
 
+    if (size >= KHEAP_VMALLOC_MIN)                                      // large buffer: own pages + guard, heap untouched
+        return vmalloc(size);
+
     size_t asize = ALIGN(size) + DWSIZE;                                // block size =  ALIGN(size) + DSIZE = 8-byte-aligned payload + header(4) + footer(4)
     if (asize < MIN_BLOCK) asize = MIN_BLOCK;
 
-    // walk heap sequentially first-fit search through the implicit free list
-    for (char *bp = NEXT_BLKP(heap_listp); GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
-
-        if (!GET_ALLOC(HDRP(bp)) && GET_SIZE(HDRP(bp)) >= asize) {
-            place(bp, asize);
-            return bp;
-        }
-
+    char *fit = find_fit(asize);                                        // only free blocks are visited
+    if (fit) {
+        place(fit, asize);
+        return fit;
     }
 
     size_t extsize = (asize > PAGE_SIZE) ? asize : PAGE_SIZE;           // if (asize > pagesize) -> extsize = asize, else extsize = PAGE_SIZE
@@ -251,6 +415,9 @@ void *kmalloc_aligned(size_t size) {
 
     // allocate enough to guarantee finding a page-aligned address inside
     size_t total = size + PAGE_SIZE + sizeof(uint32_t);                         // at least sizeof(uint32_t) bytes before it for back-pointer.
+
+    if (total >= KHEAP_VMALLOC_MIN)                                             // padded block would be a vmalloc area: vmalloc areas are page aligned already
+        return vmalloc(size);                                                   // (kfree_aligned -> vfree needs the area start)
     char *raw = (char *)kmalloc(total);
     if (!raw) return 0;
 
@@ -268,13 +435,21 @@ void kfree(void *ptr) {
 
     if (!ptr) return;
 
+    if (vmalloc_owns(ptr)) {                                                    // served by vmalloc (large request)
+        vfree(ptr);
+        return;
+    }
+
     char *bp = (char *)ptr;
     size_t size = GET_SIZE(HDRP(bp));
 
     PUT(HDRP(bp), PACK(size, 0));                                               // mark free
     PUT(FTRP(bp), PACK(size, 0));
 
-    coalesce(bp);                                                               // coalesce
+    bp = coalesce(bp);                                                          // coalesce
+
+    if (GET_SIZE(HDRP(NEXT_BLKP(bp))) == 0 && GET_SIZE(HDRP(bp)) > KHEAP_TRIM_THRESHOLD)
+        trim(bp);                                                               // large free tail: pages back to the PMM
 
 }
 
@@ -282,6 +457,11 @@ void kfree_aligned(void *ptr) {
 
     if (!ptr) return;
 
+    if (vmalloc_owns(ptr)) {
+        vfree(ptr);
+        return;
+    }
+
     uint32_t original = *(uint32_t *)((char *)ptr - sizeof(uint32_t));          // original pointer
     kfree((void *)original);
 
@@ -312,6 +492,62 @@ void kheap_dump(void) {
 
     kprintf("KHEAP:  used=%u  free=%u  total=%u\n",
             (uint32_t)used, (uint32_t)free, (uint32_t)(used + free));
+
+    for (uint32_t c = 0; c < KHEAP_CLASSES; c++) {                              // per size class occupancy
+
+        uint32_t blocks = 0;
+        size_t   bytes  = 0;
+        for (char *bp = free_lists[c]; bp; bp = GET_SUCC(bp)) {
+            blocks++;
+            bytes += GET_SIZE(HDRP(bp));
+        }
+        if (!blocks) continue;
+
+        if (c == KHEAP_CLASSES - 1u)
+            kprintf("KHEAP:  class %u [%u+]  free blocks=%u  bytes=%u\n",
+                    c, MIN_BLOCK << c, blocks, (uint32_t)bytes);
+        else
+            kprintf("KHEAP:  class %u [%u - %u)  free blocks=%u  bytes=%u\n",
+                    c, MIN_BLOCK << c, MIN_BLOCK << (c + 1u), blocks, (uint32_t)bytes);
+    }
+
+    kprintf("KHEAP:  mapped=%u bytes (%u x 4MB pages)  trimmed=%u pages\n",
+            heap_virt_mapped - HEAP_START, heap_large_pages, heap_trimmed);
     kprintf("KHEAP: ────────────────────────────────────\n\n");
 
-}
\ No newline at end of file
+}
+#ifdef ORION_BENCH
+
+// boot-time trim check (make BENCH=1): a burst of small heap blocks (KHEAP_BENCH_GROUPS groups of a few sizes)
+// allocated then freed all together - free frames should return to within KHEAP_TRIM_KEEP of the start
+
+#define KHEAP_BENCH_GROUPS  256
+#define KHEAP_BENCH_OBJS    3
+
+static void *kheap_bench_blocks[KHEAP_BENCH_GROUPS][KHEAP_BENCH_OBJS];
+static const size_t kheap_bench_sizes[KHEAP_BENCH_OBJS] = { 3072, 512, 128 };
+
+void kheap_bench(void) {
+
+    uint32_t before = pmm_get_free_frames();
+
+    for (uint32_t p = 0; p < KHEAP_BENCH_GROUPS; p++)
+        for (uint32_t o = 0; o < KHEAP_BENCH_OBJS; o++)
+            kheap_bench_blocks[p][o] = kmalloc(kheap_bench_sizes[o]);
+
+    uint32_t peak = pmm_get_free_frames();
+
+    for (uint32_t p = 0; p < KHEAP_BENCH_GROUPS; p++)                               // free order = allocation order
+        for (uint32_t o = 0; o < KHEAP_BENCH_OBJS; o++)
+            kfree(kheap_bench_blocks[p][o]);
+
+    uint32_t after = pmm_get_free_frames();
+
+    kprintf("KHEAP: trim check %u block groups: free frames %u before, %u at peak, %u after (%u trimmed pages total)\n",
+            KHEAP_BENCH_GROUPS, before, peak, after, heap_trimmed);
+
+    if (after + KHEAP_TRIM_KEEP / PAGE_SIZE < before)
+        kprintf("KHEAP: WARNING — %u frames not returned after the burst\n", before - after);
+}
+
+#endif
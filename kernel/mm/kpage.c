@@ -0,0 +1,121 @@
+// Kernel Page Allocator
+
+// page-granular allocations for page-sized kernel objects (kernel stacks, slabs)
+// [KPAGE_START, KPAGE_END) tracked by a bitmap (1 bit per page, 1 = in use), first fit from a hint
+// every page backed by its own PMM frame: no heap block, no over-allocation for alignment
+
+#include "kpage.h"
+#include "vmm.h"
+#include "pmm.h"
+
+#include "kprintf.h"
+#include "cpu.h"
+
+#define KPAGE_PAGES     ((KPAGE_END - KPAGE_START) / PAGE_SIZE)
+#define KPAGE_WORDS     (KPAGE_PAGES / 32u)
+#define KPAGE_NONE      0xFFFFFFFFu
+
+static uint32_t kpage_bitmap[KPAGE_WORDS];
+static uint32_t kpage_hint  = 0;            // no free page in words below this one
+static uint32_t kpage_pages = 0;            // pages handed out
+
+static inline int  page_test(uint32_t i)    {   return (kpage_bitmap[i / 32u] >> (i % 32u)) & 1u;   }
+static inline void page_set(uint32_t i)     {   kpage_bitmap[i / 32u] |=  (1u << (i % 32u));        }
+static inline void page_clear(uint32_t i)   {   kpage_bitmap[i / 32u] &= ~(1u << (i % 32u));        }
+
+// first run of n clear bits (KPAGE_NONE = none)
+static uint32_t find_run(uint32_t n) {
+
+    uint32_t w = kpage_hint;
+    while (w < KPAGE_WORDS && kpage_bitmap[w] == 0xFFFFFFFFu)                  // skip full words
+        w++;
+    kpage_hint = w;
+
+    if (n == 1)                                                                 // common case: one page (kernel stack, slab)
+        return (w < KPAGE_WORDS) ? w * 32u + cpu_bsf(~kpage_bitmap[w]) : KPAGE_NONE;
+
+    uint32_t run = 0;
+    for (uint32_t i = w * 32u; i < KPAGE_PAGES; i++) {
+        run = page_test(i) ? 0 : run + 1;
+        if (run == n)
+            return i + 1 - n;
+    }
+
+    return KPAGE_NONE;
+}
+
+// unmap pages [first, first + n), frames back to the PMM (pages never mapped are skipped), bits cleared
+static void release(uint32_t first, uint32_t n) {
+
+    uint32_t flags = cpu_irq_save();
+
+    vmm_free_range(KPAGE_START + first * PAGE_SIZE, n * PAGE_SIZE);
+
+    for (uint32_t i = 0; i < n; i++)
+        page_clear(first + i);
+    kpage_pages -= n;
+    if (first / 32u < kpage_hint)
+        kpage_hint = first / 32u;
+
+    cpu_irq_restore(flags);
+}
+
+void *kpage_alloc(uint32_t npages) {
+
+    if (!npages || npages > KPAGE_PAGES) return 0;
+
+    uint32_t flags = cpu_irq_save();                                            // reserve the pages before mapping them
+
+    uint32_t first = find_run(npages);
+    if (first == KPAGE_NONE) {
+        cpu_irq_restore(flags);
+        kprintf("KPAGE: kpage_alloc — no run of %u pages left\n", npages);
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < npages; i++)
+        page_set(first + i);
+    kpage_pages += npages;
+
+    cpu_irq_restore(flags);
+
+    uint32_t virt = KPAGE_START + first * PAGE_SIZE;
+
+    for (uint32_t i = 0; i < npages; i++) {
+        if (!vmm_alloc_page(virt + i * PAGE_SIZE, VMM_KERNEL_RW)) {
+            kprintf("KPAGE: kpage_alloc — PMM out of physical frames\n");
+            release(first, npages);
+            return 0;
+        }
+    }
+
+    return (void *)virt;
+}
+
+void kpage_free(void *ptr, uint32_t npages) {
+
+    if (!ptr) return;
+
+    uint32_t virt = (uint32_t)ptr;
+
+    if (virt < KPAGE_START || virt >= KPAGE_END || (virt & (PAGE_SIZE - 1u)) ||
+        npages > (KPAGE_END - virt) / PAGE_SIZE) {
+        kprintf("KPAGE: kpage_free — bad range %p + %u pages\n", virt, npages);
+        return;
+    }
+
+    uint32_t first = (virt - KPAGE_START) / PAGE_SIZE;
+
+    for (uint32_t i = 0; i < npages; i++) {
+        if (!page_test(first + i)) {
+            kprintf("KPAGE: kpage_free — WARNING: double-free of %p\n", virt + i * PAGE_SIZE);
+            return;
+        }
+    }
+
+    release(first, npages);
+}
+
+size_t kpage_used(void) {
+    return (size_t)kpage_pages * PAGE_SIZE;
+}
@@ -1,10 +1,56 @@
-// Bitmap Physical Memory Manager
+// Buddy Physical Memory Manager
+
+// frame state   = bitmap (1 bit per frame: 1 = reserved / allocated, 0 = free)
+// free blocks   = buddy maps (1 bit per block per order: 1 = block is free at that order)
+// summaries     = per order: level 1 = 1 bit per map word (32 blocks), level 2 = 1 bit per level 1 word (1024 blocks)
+//                 (bit set = something free below) -> lookup = bsf on 3 words instead of scanning the map
+//
+// alloc(order)  = take free block of smallest order >= wanted, split upper halves back down
+// free(order)   = merge with buddy (idx ^ 1) while buddy is free at same order
+// zones         = frame ranges sharing the maps (a block never crosses a zone: 16MB is a multiple of 4MB)
+// colours       = per-colour bins refilled one block (1 frame of every colour) at a time, cache geometry from CPUID leaf 4
+// deferred init = boot feeds only RAM below PMM_EARLY_LIMIT to the buddy maps, the idle thread does the rest in 4MB chunks
 
 #include "pmm.h"
 #include "multiboot.h"
+#include "cpu.h"
 
 static uint32_t bitmap[PMM_BITMAP_SIZE];            // bitmap storage = 128KB (lives in boot.asm/.BSS)
 
+// order k map = (PMM_MAX_FRAMES >> k) bits = (PMM_BITMAP_SIZE >> k) words, all orders packed back to back
+// offset(k) = sum of words of orders below k = 2*PMM_BITMAP_SIZE - (2*PMM_BITMAP_SIZE >> k)
+#define BUDDY_MAP_OFFSET(order) ((2u * PMM_BITMAP_SIZE) - ((2u * PMM_BITMAP_SIZE) >> (order)))
+#define BUDDY_MAP_WORDS         BUDDY_MAP_OFFSET(PMM_MAX_ORDER + 1)                 // ~256KB for orders 0-10
+
+// level 1 summary of order k = (PMM_BITMAP_SIZE >> k) / 32 words, packed the same way
+#define BUDDY_SUM1_OFFSET(order) (BUDDY_MAP_OFFSET(order) / 32u)
+#define BUDDY_SUM1_WORDS         BUDDY_SUM1_OFFSET(PMM_MAX_ORDER + 1)
+#define BUDDY_SUM2_WORDS         (PMM_BITMAP_SIZE / 1024u)                      // level 2 per order = 32 words (order 0 needs all)
+
+static uint32_t buddy_map[BUDDY_MAP_WORDS];                     // free block maps (.BSS = all orders empty)
+static uint32_t buddy_sum1[BUDDY_SUM1_WORDS];                   // 1 bit per map word with a free block
+static uint32_t buddy_sum2[PMM_MAX_ORDER + 1][BUDDY_SUM2_WORDS];    // 1 bit per sum1 word with a set bit
+
+// zone descriptor (built from the mmap by buddy_add_range)
+typedef struct {
+    const char *name;
+    uint32_t    start;                          // first frame
+    uint32_t    end;                            // frame past the zone
+    uint32_t    managed;                        // usable frames handed to the buddy maps
+    uint32_t    free;                           // frames free in the buddy maps
+    uint32_t    wmark_low;                      // fallback from higher zones stops at this many free frames
+    uint32_t    nr_free[PMM_MAX_ORDER + 1];     // free blocks per order
+} pmm_zone_t;
+
+static pmm_zone_t zones[PMM_ZONE_COUNT] = {
+    [PMM_ZONE_DMA]    = { .name = "DMA",    .start = 0,                                .end = PMM_DMA_LIMIT >> PAGE_SHIFT },
+    [PMM_ZONE_NORMAL] = { .name = "NORMAL", .start = PMM_DMA_LIMIT >> PAGE_SHIFT,     .end = (uint32_t)PMM_MAX_FRAMES     },
+};
+
+static inline pmm_zone_t *pmm_zone_of(uint32_t frame) {
+    return (frame < zones[PMM_ZONE_NORMAL].start) ? &zones[PMM_ZONE_DMA] : &zones[PMM_ZONE_NORMAL];
+}
+
 
 // [frame / 32] = select word
 // (frame % 32) = select bit
@@ -12,65 +58,432 @@ static inline void bitmap_set(uint32_t frame)   {     bitmap[frame / 32] |= (1u
 static inline void bitmap_clear(uint32_t frame) {   bitmap[frame / 32] &= ~(1u << (frame % 32));        }       // mark frame in bitmap available
 static inline int bitmap_test(uint32_t frame)   {     return (bitmap[frame / 32] >> (frame % 32)) & 1;  }       // return frame state
 
+// held map: reserved frames parked in a magazine, zero pool or colour bin (not owned by any caller)
+// a free of a held frame = double free, even though the bitmap still says reserved
+static uint32_t held_map[PMM_BITMAP_SIZE];
+static inline void held_set(uint32_t frame)     {     held_map[frame / 32] |= (1u << (frame % 32));     }
+static inline void held_clear(uint32_t frame)   {     held_map[frame / 32] &= ~(1u << (frame % 32));    }
+static inline int held_test(uint32_t frame)     {     return (held_map[frame / 32] >> (frame % 32)) & 1; }
+
+// frame can be freed: reserved and handed out to a caller
+static inline int frame_owned(uint32_t frame)   {     return bitmap_test(frame) && !held_test(frame);   }
+
 static uint32_t pmm_total_frames = 0;   // memory detected from mmap
 static uint32_t pmm_used_frames = 0;    // reserved frames
-static uint32_t pmm_alloc_search = 1;         // Start searching here (skip frame 0)
+
+// per-CPU magazine: stack of frames already taken from the buddy maps (marked reserved in bitmap)
+// only its own CPU touches it, inside an interrupt-disabled section -> no lock
+typedef struct {
+    uint32_t count;                         // frames on the stack
+    uint32_t frame[PMM_CACHE_SIZE];         // frame numbers (top = most recently freed = cache warm)
+    uint32_t hits;
+    uint32_t misses;
+} pmm_cache_t;
+
+static pmm_cache_t pmm_cache[MAX_CPUS];
+static uint32_t    pmm_cached_frames = 0;   // frames sitting in all CPU caches (counted as used)
+
+// pre-zeroed pools: filled by pmm_zero_idle() when nothing is runnable (frames marked reserved in bitmap)
+static uint32_t zero_pool[PMM_ZONE_COUNT][PMM_ZERO_POOL_SIZE];
+static uint32_t zero_pool_count[PMM_ZONE_COUNT];
+static const uint32_t zero_pool_target[PMM_ZONE_COUNT] = {
+    [PMM_ZONE_DMA]    = PMM_ZERO_POOL_DMA,
+    [PMM_ZONE_NORMAL] = PMM_ZERO_POOL_SIZE,
+};
+static uint32_t zero_hits       = 0;
+static uint32_t zero_misses     = 0;
+
+// page colour bins: frames taken from the buddy maps (marked reserved in bitmap), one stack per colour
+static uint32_t color_count = 1;                    // colours in use (power of two, 1 = colouring unavailable)
+static uint32_t color_order = 0;                    // log2(color_count) = order of a block holding every colour once
+static int      color_mode  = 0;
+static uint32_t color_bin[PMM_MAX_COLORS][PMM_COLOR_BIN];
+static uint32_t color_bin_count[PMM_MAX_COLORS];
+static uint32_t pmm_colored_frames = 0;             // frames sitting in colour bins (counted as used)
+
+// frame sharing (copy-on-write): extra references per frame, 0 = one owner (table sized to top of RAM, lives in the DMA zone)
+static uint8_t  *frame_refs = 0;
+static uint32_t  frame_refs_frames = 0;
 
 #include "kprintf.h"
 #include "serial.h"
+#include "vmm.h"
+#include "panic.h"
 
+// mask of n bits starting at bit (n = 1..32, bit + n <= 32)
+static inline uint32_t bitmap_mask(uint32_t bit, uint32_t n) {  return ((n == 32) ? 0xFFFFFFFF : ((1u << n) - 1)) << bit;  }
 
+// mark frame range in bitmap reserved / available a word at a time, return number of frames that changed state
+static uint32_t bitmap_set_range(uint32_t frame, uint32_t count) {
 
-// mark physical address range reserved
-static void pmm_mark_region_reserved(uint64_t base, uint64_t len) {
+    uint32_t changed = 0;
 
-    uint64_t aligned_base = (base + PAGE_SIZE - 1) &~(uint64_t)(PAGE_SIZE - 1);         // if base = mid page -> move to next page (base = ceiling)
-    if (aligned_base > base + len) return;                                              
+    while (count) {
+        uint32_t bit  = frame % 32;
+        uint32_t n    = (32 - bit < count) ? 32 - bit : count;
+        uint32_t mask = bitmap_mask(bit, n);
+
+        changed += (uint32_t)__builtin_popcount(~bitmap[frame / 32] & mask);   // free bits about to be reserved
+        bitmap[frame / 32] |= mask;
+
+        frame += n;
+        count -= n;
+    }
+
+    return changed;
+}
+
+static uint32_t bitmap_clear_range(uint32_t frame, uint32_t count) {
+
+    uint32_t changed = 0;
+
+    while (count) {
+        uint32_t bit  = frame % 32;
+        uint32_t n    = (32 - bit < count) ? 32 - bit : count;
+        uint32_t mask = bitmap_mask(bit, n);
+
+        changed += (uint32_t)__builtin_popcount(bitmap[frame / 32] & mask);    // reserved bits about to be freed
+        bitmap[frame / 32] &= ~mask;
+
+        frame += n;
+        count -= n;
+    }
+
+    return changed;
+}
+
+// BUDDY MAPS
+
+// idx = block index within its order (frame = idx << order)
+static inline uint32_t *buddy_order_map(uint32_t order) {   return &buddy_map[BUDDY_MAP_OFFSET(order)];                     }
+static inline int buddy_test(uint32_t idx, uint32_t order) {  return (buddy_order_map(order)[idx / 32] >> (idx % 32)) & 1;    }
+
+static inline uint32_t *buddy_order_sum1(uint32_t order) {  return &buddy_sum1[BUDDY_SUM1_OFFSET(order)];                   }
+
+static inline void buddy_insert(uint32_t idx, uint32_t order) {     // block becomes free at order
+
+    uint32_t w = idx / 32;                                          // map word / sum1 bit
+
+    buddy_order_map(order)[w]       |= (1u << (idx % 32));
+    buddy_order_sum1(order)[w / 32] |= (1u << (w % 32));            // word now has a free block
+    buddy_sum2[order][w / 1024]     |= (1u << ((w / 32) % 32));     // sum1 word now non-zero
+
+    pmm_zone_t *z = pmm_zone_of(idx << order);
+    z->nr_free[order]++;
+    z->free += PMM_ORDER_FRAMES(order);
+}
+
+static inline void buddy_remove(uint32_t idx, uint32_t order) {     // block leaves free map at order
+
+    uint32_t w = idx / 32;
+    uint32_t *map  = buddy_order_map(order);
+    uint32_t *sum1 = buddy_order_sum1(order);
+
+    map[w] &= ~(1u << (idx % 32));
+    if (map[w] == 0) {                                              // last free block in word
+        sum1[w / 32] &= ~(1u << (w % 32));
+        if (sum1[w / 32] == 0)                                      // last non-empty word in 1024 blocks
+            buddy_sum2[order][w / 1024] &= ~(1u << ((w / 32) % 32));
+    }
+
+    pmm_zone_t *z = pmm_zone_of(idx << order);
+    z->nr_free[order]--;
+    z->free -= PMM_ORDER_FRAMES(order);
+}
+
+#define BUDDY_NONE 0xFFFFFFFFu
+
+// return index of the lowest free block at order with index >= from (BUDDY_NONE if there is none)
+static uint32_t buddy_find(uint32_t order, uint32_t from) {
+
+    uint32_t *map      = buddy_order_map(order);
+    uint32_t *sum1     = buddy_order_sum1(order);
+    uint32_t  m_words  = PMM_BITMAP_SIZE >> order;
+    uint32_t  s1_words = m_words / 32;
+    uint32_t  s2_words = (s1_words + 31) / 32;
+
+    uint32_t w = from / 32;
+    if (w >= m_words) return BUDDY_NONE;
 
-    uint64_t aligned_len  = len - (aligned_base - base);                                // mark only full frames (length = floor)
-    aligned_len &= ~(uint64_t)(PAGE_SIZE - 1);
+    uint32_t bits = map[w] & (~0u << (from % 32));                  // level 0: rest of the starting word
+    if (bits) return w * 32 + cpu_bsf(bits);
 
-    // byte region -> frame range
-    uint32_t frame = (uint32_t)(aligned_base >> PAGE_SHIFT);
-    uint32_t count = (uint32_t)(aligned_len  >> PAGE_SHIFT);
+    w++;                                                            // level 1: later map words under the same sum1 word
+    uint32_t s1 = w / 32;
+    if (s1 >= s1_words) return BUDDY_NONE;
 
-    for (uint32_t i = 0; i < count; i++) {                          // mark frames reserved
-        if (!bitmap_test(frame + i)) {
-            bitmap_set(frame + i);
-            pmm_used_frames++;                  // increment pmm_used_frames (prevent double counting)
+    bits = sum1[s1] & (~0u << (w % 32));
+    if (!bits) {
+
+        s1++;                                                       // level 2: later sum1 words (at most 32 words at order 0)
+        uint32_t s2 = s1 / 32;
+        if (s2 >= s2_words) return BUDDY_NONE;
+
+        bits = buddy_sum2[order][s2] & (~0u << (s1 % 32));
+        while (!bits) {
+            if (++s2 >= s2_words) return BUDDY_NONE;
+            bits = buddy_sum2[order][s2];
         }
+
+        s1   = s2 * 32 + cpu_bsf(bits);                             // first non-empty sum1 word
+        bits = sum1[s1];
     }
 
+    w = s1 * 32 + cpu_bsf(bits);                                    // first map word with a free block
+    return w * 32 + cpu_bsf(map[w]);                                // first free block in that word
 }
 
-// mark physical address range available
-static void pmm_mark_region_available(uint64_t base, uint64_t len) {
+// take 2^order frames of zone out of the buddy maps, return first frame (0 = none: frame 0 is never free)
+static uint32_t buddy_alloc(uint32_t order, pmm_zone_t *z) {
 
-    uint64_t aligned_base = (base + PAGE_SIZE - 1) &~(uint64_t)(PAGE_SIZE - 1);             // same logic as reversed func
-    if (aligned_base >= base + len) return;
+    for (uint32_t k = order; k <= PMM_MAX_ORDER; k++) {
+
+        if (z->nr_free[k] == 0) continue;                           // smallest order with a free block in zone
 
-    uint64_t aligned_len  = (len - (aligned_base - base)) &~(uint64_t)(PAGE_SIZE - 1);      // similar logic as reversed func (remove partial frames)
+        uint32_t idx = buddy_find(k, z->start >> k);
+        if (idx == BUDDY_NONE || idx >= (z->end >> k)) {
+            kprintf("PMM: FATAL — zone %s order %u count/map mismatch\n", z->name, k);
+            return 0;
+        }
 
-    // byte region -> frame range
-    uint32_t frame = (uint32_t)(aligned_base >> PAGE_SHIFT);
-    uint32_t count = (uint32_t)(aligned_len  >> PAGE_SHIFT);
+        buddy_remove(idx, k);
 
-    for (uint32_t i = 0; i < count; i++) {              // mark frames available (frame 0 still protected)
-        if (frame + i == 0) continue;                   // Never free the zero frame
-        if (bitmap_test(frame + i)) {
-            bitmap_clear(frame + i);
-            pmm_used_frames--;                          // unmark reserved
-            pmm_total_frames++;                         // mark available
+        while (k > order) {                                         // split: keep lower half, free upper half
+            k--;
+            idx <<= 1;
+            buddy_insert(idx + 1, k);
         }
+
+        return idx << order;
+    }
+
+    return 0;
+}
+
+// return 2^order frames starting at frame to the buddy maps (merging with free buddies)
+static void buddy_release(uint32_t frame, uint32_t order) {
+
+    uint32_t idx = frame >> order;
+
+    while (order < PMM_MAX_ORDER && buddy_test(idx ^ 1, order)) {  // buddy free at same order -> merge
+        buddy_remove(idx ^ 1, order);
+        idx >>= 1;
+        order++;
+    }
+
+    buddy_insert(idx, order);
+}
+
+// feed free frame run [frame, frame + count) to buddy as largest naturally aligned blocks
+static void buddy_add_range(uint32_t frame, uint32_t count) {
+
+    while (count) {
+
+        uint32_t order = PMM_MAX_ORDER;
+        while (order > 0 && ((frame & (PMM_ORDER_FRAMES(order) - 1)) || PMM_ORDER_FRAMES(order) > count))
+            order--;
+
+        buddy_release(frame, order);
+        pmm_zone_of(frame)->managed += PMM_ORDER_FRAMES(order);
+        frame += PMM_ORDER_FRAMES(order);
+        count -= PMM_ORDER_FRAMES(order);
+    }
+}
+
+// build buddy maps from the free frames of bitmap words [start, end) (frame bounds multiple of 32)
+static void buddy_add_free_runs(uint32_t start, uint32_t end) {
+
+    uint32_t run_start = 0;
+    uint32_t run_len   = 0;
+
+    for (uint32_t w = start / 32; w < end / 32; w++) {
+
+        if (bitmap[w] == 0xFFFFFFFF) {                              // fully reserved word ends any run
+            if (run_len) buddy_add_range(run_start, run_len);
+            run_len = 0;
+            continue;
+        }
+
+        if (bitmap[w] == 0) {                                       // fully free word extends / starts a run
+            if (!run_len) run_start = w * 32;
+            run_len += 32;
+            continue;
+        }
+
+        for (uint32_t bit = 0; bit < 32; bit++) {
+
+            uint32_t frame = w * 32 + bit;
+
+            if (!bitmap_test(frame)) {
+                if (!run_len) run_start = frame;
+                run_len++;
+            } else if (run_len) {
+                buddy_add_range(run_start, run_len);
+                run_len = 0;
+            }
+        }
+    }
+
+    if (run_len) buddy_add_range(run_start, run_len);
+}
+
+
+
+// DEFERRED INIT
+
+// usable RAM regions from the mmap (frame ranges); pmm_init only brings [0, PMM_EARLY_LIMIT) online,
+// the rest is fed to the buddy maps in PMM_DEFER_CHUNK steps by pmm_init_deferred() from the idle thread
+typedef struct {
+    uint32_t start;                             // first frame
+    uint32_t end;                               // frame past the region
+} pmm_region_t;
+
+static pmm_region_t pmm_regions[PMM_MAX_REGIONS];
+static uint32_t     pmm_region_count = 0;
+
+static uint32_t kernel_frame_start = 0;         // kernel image frames (kept reserved as ranges come online)
+static uint32_t kernel_frame_end   = 0;
+
+static uint32_t deferred_next = 0;              // first frame not yet online
+static uint32_t deferred_end  = 0;              // frame past the highest usable region (chunk aligned)
+
+// record available physical address range (full frames only)
+static void pmm_record_region(uint64_t base, uint64_t len) {
+
+    uint64_t aligned_base = (base + PAGE_SIZE - 1) &~(uint64_t)(PAGE_SIZE - 1);         // if base = mid page -> move to next page (base = ceiling)
+    if (aligned_base >= base + len) return;
+
+    uint64_t aligned_len  = (len - (aligned_base - base)) &~(uint64_t)(PAGE_SIZE - 1);  // remove partial frames (length = floor)
+    if (!aligned_len) return;
+
+    if (pmm_region_count == PMM_MAX_REGIONS) {
+        kprintf("PMM: Too many memory regions, ignoring %p\n", (uint32_t)aligned_base);
+        return;
+    }
+
+    pmm_region_t *r = &pmm_regions[pmm_region_count++];
+    r->start = (uint32_t)(aligned_base >> PAGE_SHIFT);
+    r->end   = (uint32_t)((aligned_base + aligned_len) >> PAGE_SHIFT);
+}
+
+// bring frames [start, end) online: mark recorded regions available, re-reserve kernel + frame 0, feed free runs to the buddy maps
+static void pmm_online_range(uint32_t start, uint32_t end) {
+
+    for (uint32_t i = 0; i < pmm_region_count; i++) {
+        uint32_t s = (pmm_regions[i].start > start) ? pmm_regions[i].start : start;
+        uint32_t e = (pmm_regions[i].end   < end)   ? pmm_regions[i].end   : end;
+        if (s >= e) continue;
+
+        uint32_t n = bitmap_clear_range(s, e - s);              // overlapping regions only count once
+        pmm_used_frames  -= n;
+        pmm_total_frames += n;
+    }
+
+    uint32_t ks = (kernel_frame_start > start) ? kernel_frame_start : start;
+    uint32_t ke = (kernel_frame_end   < end)   ? kernel_frame_end   : end;
+    if (ks < ke)
+        pmm_used_frames += bitmap_set_range(ks, ke - ks);       // reserve kernel image
+
+    if (start == 0 && !bitmap_test(0)) {                        // reserve frame 0 explicitly
+        bitmap_set(0);
+        pmm_used_frames++;
+    }
+
+    buddy_add_free_runs(start, end);                            // free frames -> buddy blocks
+}
+
+// bring the next deferred chunk online, 0 when nothing is left
+static int pmm_deferred_step(void) {
+
+    uint32_t flags = cpu_irq_save();
+
+    if (deferred_next >= deferred_end) {
+        cpu_irq_restore(flags);
+        return 0;
+    }
+
+    uint32_t start = deferred_next;
+    deferred_next += PMM_DEFER_CHUNK;
+    pmm_online_range(start, deferred_next);
+
+    cpu_irq_restore(flags);
+    return 1;
+}
+
+// idle-time work: bring all remaining RAM online (one chunk per interrupt-disabled section)
+void pmm_init_deferred(void) {
+
+    if (deferred_next >= deferred_end) return;
+
+    uint32_t before = pmm_total_frames;
+    uint64_t t0 = rdtsc();
+
+    while (pmm_deferred_step())
+        ;
+
+    uint64_t cycles = rdtsc() - t0;
+    kprintf("PMM: Deferred init brought %u frames online in %u cycles (kept off the boot path)\n",
+            pmm_total_frames - before, (uint32_t)cycles);
+}
+
+// PAGE COLOURS
+
+// size the colour set from the last cache level CPUID leaf 4 describes (way size / PAGE_SIZE)
+static void pmm_color_init(void) {
+
+    uint32_t a, b, c, d;
+    cpu_cpuid(0, 0, &a, &b, &c, &d);
+    if (a < 4) {                                                            // no deterministic cache parameters leaf
+        kprintf("PMM: CPUID leaf 4 unavailable, page colouring off\n");
+        return;
     }
 
+    uint32_t level = 0, ways = 0, line = 0, size = 0, colors = 1;
+
+    for (uint32_t sub = 0; sub < 16; sub++) {
+
+        cpu_cpuid(4, sub, &a, &b, &c, &d);
+
+        uint32_t type = a & 0x1F;                                           // 0 = no more caches, 2 = instruction only
+        if (type == 0) break;
+        if (type == 2) continue;
+
+        uint32_t l_level = (a >> 5) & 0x7;
+        uint32_t l_line  = (b & 0xFFF) + 1;
+        uint32_t l_parts = ((b >> 12) & 0x3FF) + 1;
+        uint32_t l_ways  = ((b >> 22) & 0x3FF) + 1;
+        uint32_t l_sets  = c + 1;
+
+        if (l_level < level) continue;                                      // keep the outermost data/unified cache
+
+        level  = l_level;
+        ways   = l_ways;
+        line   = l_line;
+        size   = l_ways * l_parts * l_line * l_sets;
+        colors = (l_parts * l_line * l_sets) / PAGE_SIZE;                   // one way = colors pages
+    }
+
+    if (colors < 1) colors = 1;
+    if (colors > PMM_MAX_COLORS) colors = PMM_MAX_COLORS;
+    while (colors & (colors - 1)) colors &= colors - 1;                     // round down to a power of two
+
+    color_count = colors;
+    color_order = cpu_bsf(colors);
+    color_mode  = (colors > 1);
+
+    kprintf("PMM: L%u cache %uKB %u-way %uB lines -> %u page colours (colouring %s)\n",
+            level, size / 1024, ways, line, color_count, color_mode ? "on" : "off");
 }
 
+static uint32_t pmm_take_zone(uint32_t order, pmm_zone_t *z);      // take/give layer below
+
 // initialise physical memory manager
 void pmm_init(multiboot_info_t *mbi, uint32_t kernel_phys_start, uint32_t kernel_phys_end) {
 
     kprintf("\nPMM: Initialising physical memory manager\n");
 
+    uint64_t t0 = rdtsc();
+
     for (uint32_t i = 0; i < PMM_BITMAP_SIZE; i++)                              // mark all frames reserved (deny-by-default memory policy)
         bitmap[i] = 0xFFFFFFFF;
 
@@ -85,15 +498,15 @@ void pmm_init(multiboot_info_t *mbi, uint32_t kernel_phys_start, uint32_t kernel
             kprintf("PMM: Falling back to mem_upper field\n");
 
             uint64_t mem_bytes = (uint64_t)(mbi->mem_upper) * 1024;
-            pmm_mark_region_available(0x100000, mem_bytes);                          // Free above 1MB
+            pmm_record_region(0x100000, mem_bytes);                                  // Free above 1MB
         }
 
     } else {                                        // parse GRUB mmap
 
         kprintf("PMM: Parsing GRUB memory map:\n");
 
-        multiboot_mmap_entry_t *entry = (multiboot_mmap_entry_t *)(uint32_t)mbi->mmap_addr;
-        uint32_t mmap_end = mbi->mmap_addr + mbi->mmap_length;
+        multiboot_mmap_entry_t *entry = (multiboot_mmap_entry_t *)P2V(mbi->mmap_addr);     // physical -> direct map
+        uint32_t mmap_end = P2V(mbi->mmap_addr + mbi->mmap_length);
 
         kprintf("  [ HIGH BASE: LOW BASE  +   LENGTH  ]\n");
 
@@ -120,7 +533,7 @@ void pmm_init(multiboot_info_t *mbi, uint32_t kernel_phys_start, uint32_t kernel
                     uint64_t top = entry->addr + entry->len;
                     if (top > 0x100000000ULL)                                                           // clamp memory to 4GB explicitly
                         top = 0x100000000ULL;
-                    pmm_mark_region_available((uint32_t)entry->addr, (uint32_t)(top - entry->addr)); 
+                    pmm_record_region(entry->addr, top - entry->addr);
                 }
 
             } else {                                            // else memory reserved
@@ -131,86 +544,566 @@ void pmm_init(multiboot_info_t *mbi, uint32_t kernel_phys_start, uint32_t kernel
         }
     }
 
-    kprintf("PMM: Reserving kernel image %p - %p\n",           // reserve kernel image
+    kprintf("PMM: Reserving kernel image %p - %p\n",           // reserve kernel image (partial frames included)
             kernel_phys_start, kernel_phys_end);
-    pmm_mark_region_reserved(kernel_phys_start, kernel_phys_end - kernel_phys_start);
+    kernel_frame_start = kernel_phys_start >> PAGE_SHIFT;
+    kernel_frame_end   = (kernel_phys_end + PAGE_SIZE - 1) >> PAGE_SHIFT;
+
+    uint32_t top = 0;                                           // frame past the highest usable region
+    for (uint32_t i = 0; i < pmm_region_count; i++)
+        if (pmm_regions[i].end > top) top = pmm_regions[i].end;
+
+    // early window: DMA zone + kernel image, rounded to whole chunks (everything else waits for the idle thread)
+    uint32_t early = ADDR_TO_FRAME(PMM_EARLY_LIMIT);
+    if (kernel_frame_end > early) early = kernel_frame_end;
+    early = (early + PMM_DEFER_CHUNK - 1) & ~(PMM_DEFER_CHUNK - 1);
+
+    deferred_end  = (top + PMM_DEFER_CHUNK - 1) & ~(PMM_DEFER_CHUNK - 1);
+    deferred_next = early;
+
+    pmm_online_range(0, early);
+
+    // reference count table: 1 byte per frame up to the top of RAM, one block from the direct-mapped DMA zone
+    uint32_t refs_order = 0;
+    while (refs_order < PMM_MAX_ORDER && PMM_ORDER_FRAMES(refs_order) * PAGE_SIZE < top)
+        refs_order++;
+    uint32_t refs_frame = pmm_take_zone(refs_order, &zones[PMM_ZONE_DMA]);
+    if (!refs_frame)
+        panic("PMM: Cannot allocate frame reference table");
+    frame_refs        = (uint8_t *)P2V(FRAME_TO_ADDR(refs_frame));
+    frame_refs_frames = PMM_ORDER_FRAMES(refs_order) * PAGE_SIZE;
+    if (frame_refs_frames > top) frame_refs_frames = top;
+    for (uint32_t i = 0; i < frame_refs_frames; i++)
+        frame_refs[i] = 0;
+
+    // keep low memory for the drivers that need it: general allocations stop falling back into DMA at 1/4 of it (max 4MB)
+    pmm_zone_t *dma = &zones[PMM_ZONE_DMA];
+    if (zones[PMM_ZONE_NORMAL].managed) {
+        dma->wmark_low = dma->managed / 4;
+        if (dma->wmark_low > 1024) dma->wmark_low = 1024;
+    }
 
-    if (!bitmap_test(0)) {                                      // reserve frame 0 explicitly
-        bitmap_set(0);
-        pmm_used_frames++;
+    for (uint32_t zi = 0; zi < PMM_ZONE_COUNT; zi++) {
+        pmm_zone_t *z = &zones[zi];
+        kprintf("PMM: Zone %s [%p - %p) managed=%u low=%u free blocks [order:count]",
+                z->name, FRAME_TO_ADDR(z->start), FRAME_TO_ADDR(z->end), z->managed, z->wmark_low);
+        for (uint32_t k = 0; k <= PMM_MAX_ORDER; k++)
+            kprintf(" %u:%u", k, z->nr_free[k]);
+        kprintf("\n");
     }
 
+    pmm_color_init();
+
     uint32_t free_mb = (pmm_total_frames * PAGE_SIZE) / (1024 * 1024);          // print total frames (usable) and free MB
-    kprintf("PMM: Ready. Total usable frames: %u (~%u MB free)\n\n",
+    kprintf("PMM: Ready. Total usable frames: %u (~%u MB free)\n",
             pmm_total_frames, free_mb);
 
+    uint64_t cycles = rdtsc() - t0;
+    uint32_t pending = (deferred_end > deferred_next) ? deferred_end - deferred_next : 0;
+    kprintf("PMM: Boot-time init took %u cycles, %u frames (~%u MB) deferred to idle\n\n",
+            (uint32_t)cycles, pending, (pending * PAGE_SIZE) / (1024 * 1024));
+
 }
 
-// mark available frame reserved
-uint32_t pmm_alloc_frame(void) {
+// take 2^order frames from one zone and mark them reserved (caller has interrupts off)
+static uint32_t pmm_take_zone(uint32_t order, pmm_zone_t *z) {
+
+    uint32_t frame = buddy_alloc(order, z);
+    if (frame == 0) return 0;
+
+    bitmap_set_range(frame, PMM_ORDER_FRAMES(order));                       // alloc reserved
+    pmm_used_frames += PMM_ORDER_FRAMES(order);
+    return frame;
+}
+
+// take 2^order frames: requested zone first (bringing deferred RAM online before giving up on it),
+// then lower zones while they stay above their low watermark
+static uint32_t pmm_take(uint32_t order, uint32_t zone) {
+
+    uint32_t frame = pmm_take_zone(order, &zones[zone]);
+
+    while (!frame && pmm_deferred_step())                                   // RAM still waiting for deferred init: before touching low memory
+        frame = pmm_take_zone(order, &zones[zone]);
+
+    for (int32_t zi = (int32_t)zone - 1; !frame && zi >= 0; zi--) {        // fallback order: NORMAL -> DMA
+        pmm_zone_t *z = &zones[zi];
+        if (z->free >= z->wmark_low + PMM_ORDER_FRAMES(order))
+            frame = pmm_take_zone(order, z);
+    }
+
+    return frame;
+}
+
+// return 2^order reserved frames to the buddy maps (caller has interrupts off)
+static void pmm_give(uint32_t frame, uint32_t order) {
+
+    bitmap_clear_range(frame, PMM_ORDER_FRAMES(order));                     // free frames
+    pmm_used_frames -= PMM_ORDER_FRAMES(order);
+
+    buddy_release(frame, order);                                            // merge back into buddy maps
+}
+
+// return every frame parked in the CPU magazines and colour bins to the buddy maps, so their buddies can merge
+// (caller has interrupts off) - return frames drained
+static uint32_t pmm_drain_stashes(void) {
+
+    uint32_t drained = 0;
+
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        pmm_cache_t *c = &pmm_cache[cpu];
+        while (c->count) {
+            uint32_t frame = c->frame[--c->count];
+            held_clear(frame);
+            pmm_give(frame, 0);
+            pmm_cached_frames--;
+            drained++;
+        }
+    }
+
+    for (uint32_t i = 0; i < PMM_MAX_COLORS; i++) {
+        while (color_bin_count[i]) {
+            uint32_t frame = color_bin[i][--color_bin_count[i]];
+            held_clear(frame);
+            pmm_give(frame, 0);
+            pmm_colored_frames--;
+            drained++;
+        }
+    }
+
+    return drained;
+}
+
+// allocate 2^order contiguous frames from zone
+uint32_t pmm_alloc_frames_zone(uint32_t order, uint32_t zone) {
+
+    if (order > PMM_MAX_ORDER || zone >= PMM_ZONE_COUNT) {
+        kprintf("PMM: pmm_alloc_frames — bad request (order %u zone %u)\n", order, zone);
+        return 0;
+    }
 
     if (pmm_total_frames == 0) return 0;                                    // OOM check
 
-    uint32_t max_frames = PMM_MAX_FRAMES;
+    uint32_t flags = cpu_irq_save();
+    uint32_t frame = pmm_take(order, zone);
+    if (!frame && order > 0 && pmm_drain_stashes())                         // no block: single frames parked in caches may complete one
+        frame = pmm_take(order, zone);
+    cpu_irq_restore(flags);
 
-        for (uint32_t pass = 0; pass < 2; pass++) {                         // 2 pass search
+    if (frame == 0) {
+        kprintf("PMM: Out of memory (order %u zone %s)\n", order, zones[zone].name);
+        return 0;
+    }
 
-            uint32_t start = (pass == 0) ? pmm_alloc_search : 1;
-            uint32_t end = (pass == 0) ? max_frames : pmm_alloc_search;
-            uint32_t word_start = start / 32;
-            uint32_t word_end = (end + 31) / 32;
+    return FRAME_TO_ADDR(frame);                                            // return block address
+}
 
-            for (uint32_t w = word_start; w < word_end; w++) { 
+// allocate 2^order contiguous frames (general policy: NORMAL first)
+uint32_t pmm_alloc_frames(uint32_t order) {
+    return pmm_alloc_frames_zone(order, PMM_ZONE_NORMAL);
+}
 
-                if (bitmap[w] == 0xFFFFFFFF) continue;                  // skip fully used words
+// allocate one frame from zone (bypasses the per-CPU cache, which only holds general frames)
+uint32_t pmm_alloc_frame_zone(uint32_t zone) {
+    return pmm_alloc_frames_zone(0, zone);
+}
 
-                for (uint32_t bit = 0; bit < 32; bit++) {
+// release 2^order contiguous frames
+void pmm_free_frames(uint32_t phys_addr, uint32_t order) {
 
-                    uint32_t frame = w * 32 + bit;
-                    if (frame == 0) continue;
-                    if (frame < start || frame >= end) continue;
+    uint32_t frame = ADDR_TO_FRAME(phys_addr);                                          // address -> frame
+    if (frame == 0) return;                                                             // protect frame 0
 
-                    if (!bitmap_test(frame)) {                          // find free frame 
+    if (order > PMM_MAX_ORDER || (frame & (PMM_ORDER_FRAMES(order) - 1))) {            // block must be naturally aligned
+        kprintf("PMM: WARNING — bad free of %p (order %u)\n", phys_addr, order);
+        return;
+    }
 
-                        bitmap_set(frame);                              // alloc reserved
-                        pmm_used_frames++;
-                        pmm_alloc_search = frame + 1;                   // update search pointer
+    uint32_t flags = cpu_irq_save();
 
-                        if (pmm_alloc_search >= max_frames)             // search pointer safety
-                            pmm_alloc_search = 1;
+    if (!frame_owned(frame)) {                                          // detect double free errors
+        cpu_irq_restore(flags);
+        kprintf("PMM: WARNING — double-free of frame %p\n", phys_addr);
+        return;
+    }
 
-                        return FRAME_TO_ADDR(frame);                    // return frame address
-                }
+    pmm_give(frame, order);
+    cpu_irq_restore(flags);
+}
+
+// pop a frame from this CPU's cache, refilling from the buddy maps when empty (caller has interrupts off)
+static uint32_t pmm_cache_pop(void) {
+
+    pmm_cache_t *c = &pmm_cache[cpu_id()];
+
+    if (c->count) {
+        c->hits++;
+    } else {
+        c->misses++;
+        while (c->count < PMM_CACHE_BATCH) {                            // refill: one trip to the buddy maps
+            uint32_t frame = pmm_take(0, PMM_ZONE_NORMAL);
+            if (!frame) break;
+            c->frame[c->count++] = frame;
+            pmm_cached_frames++;
+            held_set(frame);
+        }
+    }
+
+    if (!c->count) return 0;
+
+    pmm_cached_frames--;
+    uint32_t frame = c->frame[--c->count];                              // pop most recently freed frame
+    held_clear(frame);
+    return frame;
+}
+
+// mark available frame reserved (served from this CPU's cache, refilled in batches)
+uint32_t pmm_alloc_frame(void) {
+
+    uint32_t flags = cpu_irq_save();
+
+    uint32_t frame = pmm_cache_pop();
+    if (!frame && zero_pool_count[PMM_ZONE_NORMAL]) {                   // last resort: spend a pre-zeroed frame
+        frame = zero_pool[PMM_ZONE_NORMAL][--zero_pool_count[PMM_ZONE_NORMAL]];
+        held_clear(frame);
+    }
+
+    cpu_irq_restore(flags);
+
+    if (!frame) {
+        kprintf("PMM: Out of memory \n");
+        return 0;
+    }
+    return FRAME_TO_ADDR(frame);
+}
+
+// top up every colour bin from one block of color_count frames (caller has interrupts off)
+static void pmm_color_refill(void) {
+
+    uint32_t block = pmm_take(color_order, PMM_ZONE_NORMAL);        // aligned block: frame block + i has colour i
+    if (!block) return;
+
+    for (uint32_t i = 0; i < color_count; i++) {
+        if (color_bin_count[i] < PMM_COLOR_BIN) {
+            color_bin[i][color_bin_count[i]++] = block + i;
+            pmm_colored_frames++;
+            held_set(block + i);
+        } else {
+            pmm_give(block + i, 0);                                 // bin full: frame back to the buddy maps
+        }
+    }
+}
+
+// allocate a frame whose colour = color (falls back to any colour rather than failing)
+uint32_t pmm_alloc_frame_color(uint32_t color) {
+
+    if (!color_mode) return pmm_alloc_frame();
+
+    color &= color_count - 1;
+
+    uint32_t flags = cpu_irq_save();
+
+    if (!color_bin_count[color]) pmm_color_refill();
+
+    uint32_t frame = 0;
+    if (color_bin_count[color]) {
+        frame = color_bin[color][--color_bin_count[color]];
+        pmm_colored_frames--;
+        held_clear(frame);
+    }
+
+    cpu_irq_restore(flags);
+
+    return frame ? FRAME_TO_ADDR(frame) : pmm_alloc_frame();
+}
+
+uint32_t pmm_page_color(uint32_t virt) {
+    return (virt >> PAGE_SHIFT) & (color_count - 1);
+}
+
+// switch coloured allocation on / off (bins keep their frames either way)
+void pmm_set_color_mode(int on) {
+    color_mode = on && color_count > 1;
+}
+
+// allocate a frame of zone known to be all zero
+uint32_t pmm_alloc_zeroed_frame_zone(uint32_t zone) {
+
+    if (zone >= PMM_ZONE_COUNT) return 0;
+
+    uint32_t flags = cpu_irq_save();
+
+    if (zero_pool_count[zone]) {                                        // hit: zeroing already paid for at idle
+        uint32_t frame = zero_pool[zone][--zero_pool_count[zone]];
+        held_clear(frame);
+        zero_hits++;
+        cpu_irq_restore(flags);
+        return FRAME_TO_ADDR(frame);
+    }
+
+    zero_misses++;
+    cpu_irq_restore(flags);
+
+    uint32_t phys = (zone == PMM_ZONE_NORMAL) ? pmm_alloc_frame()       // miss: zero on the caller's path
+                                              : pmm_alloc_frame_zone(zone);
+    if (phys) vmm_zero_frame(phys);
+    return phys;
+}
+
+uint32_t pmm_alloc_zeroed_frame(void) {
+    return pmm_alloc_zeroed_frame_zone(PMM_ZONE_NORMAL);
+}
+
+// refill the pre-zeroed pools (called from the idle thread, interrupts enabled)
+uint32_t pmm_zero_idle(void) {
+
+    uint32_t zeroed = 0;
+
+    for (uint32_t zone = 0; zone < PMM_ZONE_COUNT; zone++) {
+
+        while (zero_pool_count[zone] < zero_pool_target[zone]) {
+
+            uint32_t flags = cpu_irq_save();
+            uint32_t frame = (zone == PMM_ZONE_NORMAL) ? pmm_cache_pop()            // never from a zero pool itself
+                                                       : pmm_take_zone(0, &zones[zone]);
+            cpu_irq_restore(flags);
+
+            if (!frame) break;
+
+            vmm_zero_frame(FRAME_TO_ADDR(frame));                                   // the slow part, off every allocation path
+
+            flags = cpu_irq_save();
+            if (zero_pool_count[zone] < zero_pool_target[zone]) {
+                zero_pool[zone][zero_pool_count[zone]++] = frame;
+                held_set(frame);
+                zeroed++;
+                cpu_irq_restore(flags);
+            } else {                                                                // filled meanwhile: frame goes back
+                cpu_irq_restore(flags);
+                pmm_free_frame(FRAME_TO_ADDR(frame));
+                break;
             }
         }
     }
-kprintf("PMM: Out of memory \n");
-return 0;
+
+    return zeroed;
 }
 
-// mark reserved frame available
+// mark reserved frame available (pushed onto this CPU's cache, drained in batches)
 void pmm_free_frame(uint32_t phys_addr) {
 
     uint32_t frame = ADDR_TO_FRAME(phys_addr);                                          // address -> frame
     if (frame == 0) return;                                                             // protect frame 0
 
-    if (!bitmap_test(frame)) {                                          // detect double free errors
+    uint32_t flags = cpu_irq_save();
+
+    if (!frame_owned(frame)) {                                          // detect double free errors (also frames parked in a cache / pool / bin)
+        cpu_irq_restore(flags);
         kprintf("PMM: WARNING — double-free of frame %p\n", phys_addr);
         return;
     }
 
-    bitmap_clear(frame);                                // free frame
-    pmm_used_frames--;
+    if (frame < zones[PMM_ZONE_NORMAL].start) {                         // low frames go straight back to their zone
+        pmm_give(frame, 0);
+        cpu_irq_restore(flags);
+        return;
+    }
+
+    pmm_cache_t *c = &pmm_cache[cpu_id()];
 
-    if (frame < pmm_alloc_search)                       // reuse freed frames
-        pmm_alloc_search = frame;
+    if (c->count == PMM_CACHE_SIZE) {                                   // full: drain the coldest batch (bottom of stack)
+        for (uint32_t i = 0; i < PMM_CACHE_BATCH; i++) {
+            held_clear(c->frame[i]);
+            pmm_give(c->frame[i], 0);
+        }
+        for (uint32_t i = PMM_CACHE_BATCH; i < PMM_CACHE_SIZE; i++)
+            c->frame[i - PMM_CACHE_BATCH] = c->frame[i];
+        c->count          -= PMM_CACHE_BATCH;
+        pmm_cached_frames -= PMM_CACHE_BATCH;
+    }
 
+    c->frame[c->count++] = frame;
+    pmm_cached_frames++;
+    held_set(frame);
+
+    cpu_irq_restore(flags);
+}
+
+
+// FRAME REFERENCES
+
+// add a sharer to an allocated frame
+void pmm_frame_ref(uint32_t phys_addr) {
+
+    uint32_t frame = ADDR_TO_FRAME(phys_addr);
+    if (frame >= frame_refs_frames) return;
+
+    uint32_t flags = cpu_irq_save();
+    if (frame_refs[frame] == 0xFF)
+        panic("PMM: pmm_frame_ref — reference count overflow");
+    frame_refs[frame]++;
+    cpu_irq_restore(flags);
+}
+
+// drop a sharer, the last one frees the frame
+void pmm_frame_unref(uint32_t phys_addr) {
+
+    uint32_t frame = ADDR_TO_FRAME(phys_addr);
+
+    uint32_t flags = cpu_irq_save();
+    if (frame < frame_refs_frames && frame_refs[frame]) {
+        frame_refs[frame]--;
+        cpu_irq_restore(flags);
+        return;
+    }
+    cpu_irq_restore(flags);
+
+    pmm_free_frame(phys_addr);
+}
+
+// number of owners of an allocated frame
+uint32_t pmm_frame_refcount(uint32_t phys_addr) {
+
+    uint32_t frame = ADDR_TO_FRAME(phys_addr);
+    return (frame < frame_refs_frames) ? 1u + frame_refs[frame] : 1u;
 }
 
 
 // return # of total, used, free frames
 uint32_t pmm_get_total_frames(void) { return pmm_total_frames; }
 uint32_t pmm_get_used_frames(void)  { return pmm_used_frames;  }
-uint32_t pmm_get_free_frames(void)  { return pmm_total_frames - pmm_used_frames; }
+uint32_t pmm_get_free_frames(void)  { return (uint32_t)(PMM_MAX_FRAMES - pmm_used_frames) + pmm_cached_frames + pmm_colored_frames
+                                             + zero_pool_count[PMM_ZONE_DMA] + zero_pool_count[PMM_ZONE_NORMAL]; }   // used_frames counts non-RAM + cached + pooled frames as reserved
+
+uint32_t pmm_get_zone_free(uint32_t zone) { return (zone < PMM_ZONE_COUNT) ? zones[zone].free : 0; }
+uint32_t pmm_get_color_count(void)         { return color_count; }
+
+uint32_t pmm_get_zero_hits(void)    { return zero_hits;   }
+uint32_t pmm_get_zero_misses(void)  { return zero_misses; }
+
+// sum per-CPU cache counters
+uint32_t pmm_get_cache_hits(void) {
+    uint32_t n = 0;
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) n += pmm_cache[cpu].hits;
+    return n;
+}
+
+uint32_t pmm_get_cache_misses(void) {
+    uint32_t n = 0;
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) n += pmm_cache[cpu].misses;
+    return n;
+}
+
+
+#ifdef ORION_BENCH
+
+// boot-time microbenchmark (make BENCH=1): single frame latency with memory near-empty vs near-full
+
+#define PMM_BENCH_ROUNDS    4096            // alloc/free pairs per measurement
+#define PMM_BENCH_SPARE     8               // frames left free in the near-full case
+#define PMM_BENCH_BLOCKS    4096            // blocks held while filling memory
+
+static uint32_t bench_block[PMM_BENCH_BLOCKS];
+static uint8_t  bench_order[PMM_BENCH_BLOCKS];
+
+// average cycles of single-frame alloc / free: buddy path (pmm_alloc_frames(0)) or CPU cache path (pmm_alloc_frame)
+static void pmm_bench_pairs(const char *label, int cached) {
+
+    uint64_t alloc_cycles = 0;
+    uint64_t free_cycles  = 0;
+    uint32_t free_frames  = pmm_get_free_frames();
+
+    for (uint32_t i = 0; i < PMM_BENCH_ROUNDS; i++) {
+
+        uint64_t t0 = rdtsc();
+        uint32_t f  = cached ? pmm_alloc_frame() : pmm_alloc_frames(0);
+        uint64_t t1 = rdtsc();
+        if (cached) pmm_free_frame(f); else pmm_free_frames(f, 0);
+        uint64_t t2 = rdtsc();
 
+        alloc_cycles += t1 - t0;
+        free_cycles  += t2 - t1;
+    }
+
+    kprintf("PMM: bench %s %s (%u free): alloc=%u free=%u cycles\n", label, cached ? "cache" : "buddy", free_frames,
+            (uint32_t)(alloc_cycles / PMM_BENCH_ROUNDS), (uint32_t)(free_cycles / PMM_BENCH_ROUNDS));
+}
+
+// strided-access workload over PMM_BENCH_PAGES pages mapped after the scratch window:
+// same-colour pages all fall into one way-sized slice of the cache (conflict misses), spread pages use all of it
+#define PMM_BENCH_PAGES     32              // > associativity of the colouring cache, small enough to fit it
+#define PMM_BENCH_PASSES    64              // passes over the working set per measurement
+#define PMM_BENCH_LINE      64              // stride = one cache line
+#define PMM_BENCH_WINDOW    (VMM_TEMP_WINDOW + MAX_CPUS * PAGE_SIZE)   // past the per-CPU temp windows, same page table
+
+static void pmm_bench_stride(const char *label, int spread) {
+
+    uint32_t frame[PMM_BENCH_PAGES];
+
+    for (uint32_t i = 0; i < PMM_BENCH_PAGES; i++) {
+        frame[i] = pmm_alloc_frame_color(spread ? i : 0);
+        if (!frame[i]) {
+            while (i--) pmm_free_frame(frame[i]);
+            return;
+        }
+        vmm_map_page(PMM_BENCH_WINDOW + i * PAGE_SIZE, frame[i], VMM_KERNEL_RW);
+    }
+
+    volatile uint32_t *base = (volatile uint32_t *)PMM_BENCH_WINDOW;
+    uint32_t sum = 0;
+
+    for (uint32_t off = 0; off < PAGE_SIZE; off += PMM_BENCH_LINE)        // warm up
+        for (uint32_t i = 0; i < PMM_BENCH_PAGES; i++)
+            sum += base[(i * PAGE_SIZE + off) / 4];
+
+    uint64_t t0 = rdtsc();
+    for (uint32_t pass = 0; pass < PMM_BENCH_PASSES; pass++)
+        for (uint32_t off = 0; off < PAGE_SIZE; off += PMM_BENCH_LINE)
+            for (uint32_t i = 0; i < PMM_BENCH_PAGES; i++)
+                sum += base[(i * PAGE_SIZE + off) / 4];
+    uint64_t cycles = rdtsc() - t0;
+
+    uint32_t accesses = PMM_BENCH_PASSES * (PAGE_SIZE / PMM_BENCH_LINE) * PMM_BENCH_PAGES;
+    kprintf("PMM: bench stride %s (%u pages): %u cycles/access (sum %u)\n", label, PMM_BENCH_PAGES,
+            (uint32_t)(cycles / accesses), sum);
+
+    for (uint32_t i = 0; i < PMM_BENCH_PAGES; i++) {
+        vmm_unmap_page(PMM_BENCH_WINDOW + i * PAGE_SIZE);
+        pmm_free_frame(frame[i]);
+    }
+}
+
+void pmm_bench(void) {
+
+    pmm_init_deferred();                                                    // near-full case needs all RAM online
+
+    pmm_bench_pairs("near-empty", 0);
+    pmm_bench_pairs("near-empty", 1);
+
+    uint32_t held = 0;                                                      // fill from largest blocks down
+    for (int32_t order = PMM_MAX_ORDER; order >= 0 && held < PMM_BENCH_BLOCKS; order--) {
+        while (held < PMM_BENCH_BLOCKS && pmm_get_free_frames() >= PMM_BENCH_SPARE + PMM_ORDER_FRAMES(order)) {
+            uint32_t b = pmm_alloc_frames((uint32_t)order);
+            if (!b) b = pmm_alloc_frames_zone((uint32_t)order, PMM_ZONE_DMA);  // past the DMA watermark too
+            if (!b) break;
+            bench_block[held] = b;
+            bench_order[held] = (uint8_t)order;
+            held++;
+        }
+    }
+
+    pmm_bench_pairs("near-full ", 0);
+    pmm_bench_pairs("near-full ", 1);
+
+    while (held--)                                                          // hand everything back
+        pmm_free_frames(bench_block[held], bench_order[held]);
+
+    if (color_count > 1) {
+        int mode = color_mode;
+        pmm_set_color_mode(1);
+        pmm_bench_stride("one colour   ", 0);
+        pmm_bench_stride("all colours  ", 1);
+        pmm_set_color_mode(mode);
+    }
+}
 
+#endif
@@ -0,0 +1,217 @@
+// Slab Allocator
+
+// per-cache slabs of one page each, taken from the page allocator (kpage.h)
+// slab lists: partial (some free) | full (none free) | empty (all free, at most KMEM_KEEP_EMPTY kept)
+// alloc = pop from the first partial slab | free = push onto the slab found by masking the object address
+
+#include "slab.h"
+#include "kpage.h"
+#include "pmm.h"
+
+#include "kprintf.h"
+#include "cpu.h"
+
+#define KMEM_KEEP_EMPTY  1u             // empty slabs kept per cache (rest go back to the PMM)
+
+typedef struct kmem_slab {
+    struct kmem_cache *cache;           // owner (checked on free)
+    struct kmem_slab  *prev;
+    struct kmem_slab  *next;
+    void              *free;            // first free object (0 = slab full)
+    uint32_t           inuse;           // objects handed out
+} kmem_slab_t;
+
+struct kmem_cache {
+    const char  *name;
+    uint32_t     size;                  // object size as requested
+    uint32_t     link;                  // offset of the free-list word inside each slot
+    uint32_t     stride;                // bytes per slot (object + link, multiple of align)
+    uint32_t     first;                 // offset of slot 0 in the slab page
+    uint32_t     per_slab;              // objects per slab
+    void       (*ctor)(void *);
+
+    kmem_slab_t *partial;
+    kmem_slab_t *full;
+    kmem_slab_t *empty;
+    uint32_t     empty_count;
+
+    uint32_t     slabs;                 // slabs owned
+    uint32_t     active;                // objects handed out
+    uint32_t     allocs;                // kmem_cache_alloc calls served
+    uint32_t     frees;                 // kmem_cache_free calls
+};
+
+static kmem_cache_t caches[KMEM_MAX_CACHES];
+static uint32_t     cache_count = 0;
+
+#define ALIGN_UP(v, a)      (((v) + (a) - 1u) & ~((a) - 1u))
+#define SLOT_LINK(c, obj)   (*(void **)((char *)(obj) + (c)->link))
+
+// slab header of an object: slabs are page aligned, one page each
+static inline kmem_slab_t *obj_slab(void *obj) {   return (kmem_slab_t *)((uint32_t)obj & ~(uint32_t)(PAGE_SIZE - 1u));   }
+
+static void slab_push(kmem_slab_t **list, kmem_slab_t *s) {
+
+    s->prev = 0;
+    s->next = *list;
+    if (*list) (*list)->prev = s;
+    *list = s;
+}
+
+static void slab_unlink(kmem_slab_t **list, kmem_slab_t *s) {
+
+    if (s->prev) s->prev->next = s->next;
+    else         *list = s->next;
+    if (s->next) s->next->prev = s->prev;
+}
+
+// new slab: every object constructed once, threaded onto the free list
+static kmem_slab_t *slab_grow(kmem_cache_t *c) {
+
+    kmem_slab_t *s = (kmem_slab_t *)kpage_alloc(1);
+    if (!s) return 0;
+
+    s->cache = c;
+    s->inuse = 0;
+    s->free  = 0;
+
+    for (uint32_t i = c->per_slab; i-- > 0; ) {                                 // reverse: slot 0 ends up first
+        void *obj = (char *)s + c->first + i * c->stride;
+        if (c->ctor) c->ctor(obj);
+        SLOT_LINK(c, obj) = s->free;
+        s->free = obj;
+    }
+
+    c->slabs++;
+    return s;
+}
+
+kmem_cache_t *kmem_cache_create(const char *name, size_t size, size_t align, void (*ctor)(void *)) {
+
+    if (align < sizeof(void *)) align = sizeof(void *);
+
+    if (!size || size > KMEM_MAX_OBJECT || (align & (align - 1u)) || align > KMEM_MAX_OBJECT) {
+        kprintf("SLAB: kmem_cache_create — %s: bad size %u / align %u\n", name, (uint32_t)size, (uint32_t)align);
+        return 0;
+    }
+
+    uint32_t flags = cpu_irq_save();
+
+    if (cache_count == KMEM_MAX_CACHES) {
+        cpu_irq_restore(flags);
+        kprintf("SLAB: kmem_cache_create — cache table full (%s)\n", name);
+        return 0;
+    }
+
+    kmem_cache_t *c = &caches[cache_count++];
+
+    cpu_irq_restore(flags);
+
+    c->name     = name;
+    c->size     = (uint32_t)size;
+    c->link     = ALIGN_UP((uint32_t)size, (uint32_t)sizeof(void *));
+    c->stride   = ALIGN_UP(c->link + (uint32_t)sizeof(void *), (uint32_t)align);
+    c->first    = ALIGN_UP((uint32_t)sizeof(kmem_slab_t), (uint32_t)align);
+    c->per_slab = (PAGE_SIZE - c->first) / c->stride;
+    c->ctor     = ctor;
+
+    c->partial = c->full = c->empty = 0;
+    c->empty_count = 0;
+    c->slabs = c->active = c->allocs = c->frees = 0;
+
+    return c;
+}
+
+void *kmem_cache_alloc(kmem_cache_t *c) {
+
+    uint32_t flags = cpu_irq_save();
+
+    kmem_slab_t *s = c->partial;
+    if (!s && c->empty) {                                                       // reuse a kept empty slab
+        s = c->empty;
+        slab_unlink(&c->empty, s);
+        c->empty_count--;
+        slab_push(&c->partial, s);
+    }
+    if (!s) {
+        s = slab_grow(c);
+        if (!s) {
+            cpu_irq_restore(flags);
+            kprintf("SLAB: %s — out of memory for a new slab\n", c->name);
+            return 0;
+        }
+        slab_push(&c->partial, s);
+    }
+
+    void *obj = s->free;                                                        // pop
+    s->free = SLOT_LINK(c, obj);
+    s->inuse++;
+
+    if (!s->free) {                                                             // last object: partial -> full
+        slab_unlink(&c->partial, s);
+        slab_push(&c->full, s);
+    }
+
+    c->active++;
+    c->allocs++;
+
+    cpu_irq_restore(flags);
+    return obj;
+}
+
+void kmem_cache_free(kmem_cache_t *c, void *obj) {
+
+    if (!obj) return;
+
+    kmem_slab_t *s = obj_slab(obj);
+    if (s->cache != c) {
+        kprintf("SLAB: kmem_cache_free — %p does not belong to %s\n", (uint32_t)obj, c->name);
+        return;
+    }
+
+    uint32_t flags = cpu_irq_save();
+
+    if (!s->free) {                                                             // was full: full -> partial
+        slab_unlink(&c->full, s);
+        slab_push(&c->partial, s);
+    }
+
+    SLOT_LINK(c, obj) = s->free;                                                // push
+    s->free = obj;
+    s->inuse--;
+
+    c->active--;
+    c->frees++;
+
+    kmem_slab_t *release = 0;
+
+    if (s->inuse == 0) {                                                        // all free: partial -> empty (or back to the PMM)
+        slab_unlink(&c->partial, s);
+        if (c->empty_count < KMEM_KEEP_EMPTY) {
+            slab_push(&c->empty, s);
+            c->empty_count++;
+        } else {
+            release = s;
+            c->slabs--;
+        }
+    }
+
+    cpu_irq_restore(flags);
+
+    if (release)
+        kpage_free(release, 1);
+}
+
+void kmem_cache_dump(void) {
+
+    kprintf("SLAB: ────────────── dump ──────────────\n");
+
+    for (uint32_t i = 0; i < cache_count; i++) {
+        kmem_cache_t *c = &caches[i];
+        kprintf("SLAB:  %s  obj=%u stride=%u  slabs=%u (%u empty)  active=%u/%u  allocs=%u frees=%u\n",
+                c->name, c->size, c->stride, c->slabs, c->empty_count,
+                c->active, c->slabs * c->per_slab, c->allocs, c->frees);
+    }
+
+    kprintf("SLAB: ────────────────────────────────────\n\n");
+}
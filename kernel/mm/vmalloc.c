@@ -0,0 +1,125 @@
+// vmalloc
+
+// virtually contiguous kernel allocations backed by scattered frames
+// areas live in [VMALLOC_START, VMALLOC_END), sorted by address, first-fit placement
+// every area is followed by VMALLOC_GUARD unmapped pages (overrun = page fault, not heap corruption)
+
+#include "vmalloc.h"
+#include "vmm.h"
+#include "pmm.h"
+#include "slab.h"
+
+#include "kprintf.h"
+#include "cpu.h"
+
+typedef struct vm_area {
+    uint32_t        start;              // first byte (page aligned)
+    uint32_t        pages;              // pages mapped (guard pages follow)
+    struct vm_area *next;               // list sorted by start
+} vm_area_t;
+
+static kmem_cache_t *area_cache = 0;    // vm_area_t descriptors (created on first use)
+
+static vm_area_t *areas        = 0;
+static uint32_t   area_count   = 0;
+static uint32_t   mapped_pages = 0;     // pages backed by frames across all areas
+
+// virtual footprint of an area including its guard
+static inline uint32_t area_span(const vm_area_t *a) {  return (a->pages + VMALLOC_GUARD) * PAGE_SIZE;  }
+
+void *vmalloc(size_t size) {
+
+    if (!size || size > VMALLOC_END - VMALLOC_START) return 0;
+
+    uint32_t pages = ((uint32_t)size + PAGE_SIZE - 1) / PAGE_SIZE;
+    uint32_t span  = (pages + VMALLOC_GUARD) * PAGE_SIZE;
+
+    if (!area_cache)
+        area_cache = kmem_cache_create("vm_area", sizeof(vm_area_t), 0, 0);
+    if (!area_cache) return 0;
+
+    vm_area_t *a = (vm_area_t *)kmem_cache_alloc(area_cache);
+    if (!a) return 0;
+
+    uint32_t flags = cpu_irq_save();                                            // reserve the range before mapping it
+
+    uint32_t    start = VMALLOC_START;                                          // first gap that fits
+    vm_area_t **link  = &areas;
+    while (*link && (*link)->start - start < span) {
+        start = (*link)->start + area_span(*link);
+        link  = &(*link)->next;
+    }
+
+    if (VMALLOC_END - start < span) {
+        cpu_irq_restore(flags);
+        kmem_cache_free(area_cache, a);
+        kprintf("VMALLOC: vmalloc — no %u byte gap left\n", span);
+        return 0;
+    }
+
+    a->start = start;
+    a->pages = pages;
+    a->next  = *link;
+    *link    = a;
+    area_count++;
+
+    cpu_irq_restore(flags);
+
+    for (uint32_t i = 0; i < pages; i++) {                                      // one frame per page, wherever the PMM finds it
+        if (!vmm_alloc_page(start + i * PAGE_SIZE, VMM_KERNEL_RW)) {
+            kprintf("VMALLOC: vmalloc — PMM out of physical frames\n");
+            vfree((void *)start);                                               // releases the pages mapped so far
+            return 0;
+        }
+        mapped_pages++;
+    }
+
+    return (void *)start;
+}
+
+void vfree(void *ptr) {
+
+    if (!ptr) return;
+
+    uint32_t flags = cpu_irq_save();
+
+    vm_area_t **link = &areas;
+    while (*link && (*link)->start != (uint32_t)ptr)
+        link = &(*link)->next;
+
+    if (!*link) {
+        cpu_irq_restore(flags);
+        kprintf("VMALLOC: vfree — %p is not a vmalloc area\n", (uint32_t)ptr);
+        return;
+    }
+
+    vm_area_t *a = *link;
+    *link = a->next;
+    area_count--;
+
+    mapped_pages -= vmm_free_range(a->start, a->pages * PAGE_SIZE);             // pages never mapped (vmalloc failed part way) skipped
+
+    cpu_irq_restore(flags);
+    kmem_cache_free(area_cache, a);
+}
+
+int vmalloc_owns(const void *ptr) {
+    return (uint32_t)ptr >= VMALLOC_START && (uint32_t)ptr < VMALLOC_END;
+}
+
+size_t vmalloc_used(void) {
+    return (size_t)mapped_pages * PAGE_SIZE;
+}
+
+void vmalloc_dump(void) {
+
+    kprintf("VMALLOC: ────────────── dump ──────────────\n");
+
+    uint32_t idx = 0;
+    for (vm_area_t *a = areas; a; a = a->next, idx++)
+        kprintf("VMALLOC:  [%u] @ %p  pages=%u\n", idx, a->start, a->pages);
+
+    kprintf("VMALLOC:  areas=%u  mapped=%u bytes  range=%p - %p\n",
+            area_count, mapped_pages * PAGE_SIZE, VMALLOC_START, VMALLOC_END);
+    kprintf("VMALLOC: ────────────────────────────────────\n\n");
+}
@@ -3,77 +3,383 @@
 #include "vmm.h"
 #include "pmm.h"
 
+#include "slab.h"
 #include "kprintf.h"
 #include "panic.h"
+#include "cpu.h"
 
-extern void enable_paging(uint32_t pd_phys);                            // from paging.asm
 extern void tlb_flush_page(uint32_t virt);                              // from paging.asm
+extern void switch_page_directory(uint32_t pd_phys);                    // from paging.asm
+extern uint32_t get_cr4(void);                                          // from paging.asm
+extern void set_cr4(uint32_t cr4);                                      // from paging.asm
 
-// physical address of page directory (= virtual address)
-static uint32_t *page_directory = 0;
+#define CR4_PSE         (1u << 4)                                       // 4MB pages: PDEs with VMM_LARGE map memory directly
+#define CR4_PGE         (1u << 7)                                       // global pages: CR3 loads keep entries marked VMM_GLOBAL
+#define CPUID_EDX_PSE   (1u << 3)
+#define CPUID_EDX_PGE   (1u << 13)
+
+// directories are reached through the direct map (virtual = physical + KERNEL_VIRT_BASE)
+// page tables can be anywhere in RAM: the current directory's tables through the recursive slot, others through a temp window
+static uint32_t *page_directory = 0;                                    // kernel directory = master copy of the kernel half
+static uint32_t *current_directory = 0;                                 // directory loaded in CR3
+
+// every other live directory: kernel PDEs installed after creation are copied into each
+static uint32_t *spaces[VMM_MAX_SPACES];
+static uint32_t  space_count = 0;
+
+static int       temp_ready = 0;                // 1 = temp window page table exists
+static uint32_t  global_flag = 0;               // VMM_GLOBAL once CR4.PGE is on (0 = CPU has no global pages)
+static int       large_pages = 0;               // 1 = CR4.PSE on
+
+static kmem_cache_t *region_cache = 0;          // vmm_region_t nodes
 
 // 32 bit address layout = | PDE = 10 bits | PTE = 10 bits | OFFSET = 12 bits |
 #define PD_INDEX(virt) ((virt) >> 22)                                               // extract top 10 bits
 #define PT_INDEX(virt) (((virt) >> 12) & 0x3FFu)                                    // extract next 10 bits
 
+#define KERNEL_PDE      PD_INDEX(KERNEL_VIRT_BASE)                                  // PDEs [KERNEL_PDE, VMM_RECURSIVE_PDE) = kernel half
+
+// current directory through the recursive slot: table of PDE i at VMM_PT_BASE + i * 4KB, so all PTEs form one array
+static inline uint32_t *pt_of(uint32_t pd_idx) {    return (uint32_t *)(VMM_PT_BASE + pd_idx * PAGE_SIZE);  }
+static inline uint32_t *pte_of(uint32_t virt) {     return (uint32_t *)VMM_PT_BASE + (virt >> 12);          }
+
+// install kernel PDE in the kernel directory and every address space (they all share the same page table)
+static void set_kernel_pde(uint32_t pd_idx, uint32_t pde) {
+
+    uint32_t flags = cpu_irq_save();
+
+    page_directory[pd_idx] = pde;
+    for (uint32_t i = 0; i < space_count; i++)
+        spaces[i][pd_idx] = pde;
+
+    cpu_irq_restore(flags);
+}
+
+// this CPU's scratch page (one per CPU: a window is only held with interrupts off)
+static inline uint32_t temp_window(void) {  return VMM_TEMP_WINDOW + cpu_id() * PAGE_SIZE;  }
+
+// point this CPU's scratch window at a frame (caller has interrupts off until temp_unmap)
+static uint32_t *temp_map(uint32_t phys) {
+
+    if (!temp_ready)
+        panic("VMM: temp window not set up yet");
+
+    uint32_t va = temp_window();
+    *pte_of(va) = (phys & VMM_ADDR_MASK) | VMM_KERNEL_RW;                       // window -> frame
+    tlb_flush_page(va);
+    return (uint32_t *)va;
+}
+
+static void temp_unmap(void) {
+
+    uint32_t va = temp_window();
+    *pte_of(va) = 0;                                                            // close window
+    tlb_flush_page(va);
+}
+
+// pages whose stale translations a batch operation must drop before it returns
+typedef struct {
+    uint32_t count;                             // pages changed (may exceed VMM_FLUSH_THRESHOLD)
+    int      kernel;                            // 1 = a kernel-half (global) page changed
+    uint32_t pages[VMM_FLUSH_THRESHOLD];
+} tlb_batch_t;
+
+// end of the page table covering virt, clipped to end
+static inline uint32_t table_end(uint32_t virt, uint32_t end) {
+    uint32_t stop = (virt & VMM_LARGE_MASK) + VMM_LARGE_SIZE;
+    return (stop == 0 || stop > end) ? end : stop;
+}
+
+static inline void batch_add(tlb_batch_t *b, uint32_t virt) {
+
+    if (b->count < VMM_FLUSH_THRESHOLD)
+        b->pages[b->count] = virt;
+    b->count++;
+
+    if (virt >= KERNEL_VIRT_BASE)
+        b->kernel = 1;
+}
+
+// drop the whole TLB: CR3 reload, plus a CR4.PGE toggle when global entries are involved
+static void tlb_flush_all(int global) {
+
+    uint32_t flags = cpu_irq_save();
+
+    if (global && global_flag) {
+        uint32_t cr4 = get_cr4();
+        set_cr4(cr4 & ~CR4_PGE);                                                // clearing PGE flushes global entries too
+        set_cr4(cr4);
+    } else {
+        switch_page_directory(V2P(current_directory));
+    }
+
+    cpu_irq_restore(flags);
+}
+
+// few pages: one invlpg each | many: a single full flush is cheaper than the invlpg storm
+static void batch_finish(tlb_batch_t *b) {
+
+    if (b->count > VMM_FLUSH_THRESHOLD) {
+        tlb_flush_all(b->kernel);
+        return;
+    }
+
+    for (uint32_t i = 0; i < b->count; i++)
+        tlb_flush_page(b->pages[i]);
+}
+
 static uint32_t *create_table(uint32_t virt, uint32_t flags) {
 
     uint32_t pd_idx = PD_INDEX(virt);                                           // locate PDE
 
-    if (page_directory[pd_idx] & VMM_PRESENT) {                                 // if table exists
-        return (uint32_t *)(page_directory[pd_idx] & VMM_ADDR_MASK);            // return table( virtual address )
+    if (pd_idx == VMM_RECURSIVE_PDE) {                                          // the page tables themselves
+        kprintf("VMM: %p is inside the page table window\n", virt);
+        return 0;
     }
 
-    uint32_t pt_phys = pmm_alloc_frame();                                       // allocate zeroed 4KB frame for new PT
+    if (current_directory[pd_idx] & VMM_LARGE) {                                // covered by a 4MB page: no table to put a PTE in
+        kprintf("VMM: 4KB mapping at %p inside a 4MB page\n", virt);
+        return 0;
+    }
+
+    if (current_directory[pd_idx] & VMM_PRESENT) {                              // if table exists
+        return pt_of(pd_idx);                                                   // return table( virtual address )
+    }
+
+    // new PT (any zone): pre-zeroed from the idle pool, only the temp window's own table is cleared here
+    uint32_t pt_phys = temp_ready ? pmm_alloc_zeroed_frame() : pmm_alloc_frame();
     if (pt_phys == 0) {
         kprintf("VMM: FATAL — out of physical memory for page table \n");
         return 0;
     }
 
-    uint32_t *pt = (uint32_t *)pt_phys;                                         // clear every entry (all PTEs = !present)
-    for (int i = 0; i < 1024; i++)
-        pt[i] = 0;
+    uint32_t *pt = pt_of(pd_idx);                                               // reachable as soon as the PDE is in
 
     // PDE = always mark writable (per-page permissions enforced at PTE level)
-    page_directory[pd_idx] = pt_phys | VMM_PRESENT | VMM_WRITABLE | (flags & VMM_USER);     // install into directory
+    uint32_t pde = pt_phys | VMM_PRESENT | VMM_WRITABLE | (flags & VMM_USER);
+
+    uint32_t irq = cpu_irq_save();                                              // nothing may walk the table before it is zeroed
+
+    if (pd_idx >= KERNEL_PDE)
+        set_kernel_pde(pd_idx, pde);                                            // kernel half: visible in every address space
+    else
+        current_directory[pd_idx] = pde;                                        // user half: this address space only
 
+    tlb_flush_page((uint32_t)pt);                                               // window may still cache an old table / 4MB page
+    if (!temp_ready) {                                                          // bootstrap: no window to zero the frame through yet
+        for (int i = 0; i < 1024; i++)                                          // all PTEs = !present
+            pt[i] = 0;
+    }
+
+    cpu_irq_restore(irq);
     return pt;
 
 }
 
-// map single 4KB virtual page to physical page with given flags
-void vmm_map_page(uint32_t virt, uint32_t phys, uint32_t flags) {
+// map single 4KB virtual page to physical page with given flags: 0 = mapped, -1 = no frame for its page table
+int vmm_try_map_page(uint32_t virt, uint32_t phys, uint32_t flags) {
 
     uint32_t *pt = create_table(virt, flags);                                   // return page table
-    if (!pt) {
-        panic("VMM: vmm_map_page — page table allocation failed");
-    }
+    if (!pt)
+        return -1;
+
+    if (virt >= KERNEL_VIRT_BASE)                                               // kernel pages = same in every address space
+        flags |= global_flag;
 
     uint32_t pt_idx = PT_INDEX(virt);                                           // construct PTE = | frame address | flags |
     pt[pt_idx] = (phys & VMM_ADDR_MASK) | (flags | VMM_PRESENT);
 
     tlb_flush_page(virt);
+    return 0;
+}
+
+// map single 4KB virtual page, failure = fatal
+void vmm_map_page(uint32_t virt, uint32_t phys, uint32_t flags) {
+    if (vmm_try_map_page(virt, phys, flags) != 0)
+        panic("VMM: vmm_map_page — page table allocation failed");
 }
 
-// map multiple consecutive pages
+// map multiple consecutive pages: one table lookup per 4MB, invalidation only for entries that were present
 void vmm_map_range(uint32_t virt, uint32_t phys, uint32_t length, uint32_t flags) {
 
-    uint32_t offset = 0;                                            // loop through memory in 4KB steps
-    while (offset < length) {
-        vmm_map_page(virt + offset, phys + offset, flags);          // call vmm_map_page for each page
-        offset += PAGE_SIZE;
+    uint32_t end = virt + length;
+    virt &= VMM_ADDR_MASK;
+    phys &= VMM_ADDR_MASK;
+
+    if (virt >= KERNEL_VIRT_BASE)                                               // kernel pages = same in every address space
+        flags |= global_flag;
+
+    tlb_batch_t batch = { 0 };
+
+    while (virt < end) {
+
+        if (!create_table(virt, flags))
+            panic("VMM: vmm_map_range — page table allocation failed");
+
+        uint32_t stop = table_end(virt, end);
+        uint32_t *pte = pte_of(virt);
+
+        for (; virt < stop; virt += PAGE_SIZE, phys += PAGE_SIZE, pte++) {
+            if (*pte & VMM_PRESENT)                                             // not-present entries are never cached
+                batch_add(&batch, virt);
+            *pte = phys | flags | VMM_PRESENT;
+        }
+    }
+
+    batch_finish(&batch);
+}
+
+// unmap the 4KB pages of [virt, virt + length), frames back to the PMM when free_frames (4MB pages untouched, return pages unmapped)
+static uint32_t unmap_walk(uint32_t virt, uint32_t length, int free_frames) {
+
+    uint32_t end = virt + length;
+    virt &= VMM_ADDR_MASK;
+
+    tlb_batch_t batch = { 0 };
+
+    while (virt < end) {
+
+        uint32_t pd_idx = PD_INDEX(virt);
+        uint32_t stop   = table_end(virt, end);
+
+        if (pd_idx == VMM_RECURSIVE_PDE)                                        // never the page tables themselves
+            break;
+
+        uint32_t pde = current_directory[pd_idx];
+        if ((pde & VMM_PRESENT) && !(pde & VMM_LARGE)) {
+
+            uint32_t *pte = pte_of(virt);
+            for (; virt < stop; virt += PAGE_SIZE, pte++) {
+                if (!(*pte & VMM_PRESENT)) continue;
+                if (free_frames)
+                    pmm_free_frame(*pte & VMM_ADDR_MASK);
+                *pte = 0;
+                batch_add(&batch, virt);
+            }
+        }
+
+        virt = stop;
     }
+
+    batch_finish(&batch);
+    return batch.count;
+}
+
+// frames stay with the caller
+void vmm_unmap_range(uint32_t virt, uint32_t length) {
+    unmap_walk(virt, length, 0);
+}
+
+uint32_t vmm_free_range(uint32_t virt, uint32_t length) {
+
+    uint32_t flags = cpu_irq_save();                                            // frames freed before the batched flush: nothing may run in between
+    uint32_t pages = unmap_walk(virt, length, 1);
+    cpu_irq_restore(flags);
+    return pages;
+}
+
+// change the flags of every mapped 4KB page in [virt, virt + length), frames kept
+// (copy-on-write pages stay read-only: the fault breaks the sharing first)
+void vmm_protect_range(uint32_t virt, uint32_t length, uint32_t flags) {
+
+    uint32_t end = virt + length;
+    virt &= VMM_ADDR_MASK;
+
+    if (virt >= KERNEL_VIRT_BASE)
+        flags |= global_flag;
+    flags &= ~(VMM_ADDR_MASK | VMM_LARGE | VMM_COW);
+
+    tlb_batch_t batch = { 0 };
+
+    while (virt < end) {
+
+        uint32_t pd_idx = PD_INDEX(virt);
+        uint32_t stop   = table_end(virt, end);
+
+        if (pd_idx == VMM_RECURSIVE_PDE)
+            break;
+
+        uint32_t pde = current_directory[pd_idx];
+        if ((pde & VMM_PRESENT) && !(pde & VMM_LARGE)) {
+
+            uint32_t *pte = pte_of(virt);
+            for (; virt < stop; virt += PAGE_SIZE, pte++) {
+
+                uint32_t old = *pte;
+                if (!(old & VMM_PRESENT)) continue;
+
+                uint32_t new = (old & (VMM_ADDR_MASK | VMM_COW)) | flags | VMM_PRESENT;
+                if (new & VMM_COW)
+                    new &= ~VMM_WRITABLE;
+                if (new == old) continue;
+
+                *pte = new;
+                batch_add(&batch, virt);
+            }
+        }
+
+        virt = stop;
+    }
+
+    batch_finish(&batch);
+}
+
+// map virtual page to a fresh frame whose colour follows the page number (consecutive pages -> consecutive colours)
+uint32_t vmm_alloc_page(uint32_t virt, uint32_t flags) {
+
+    uint32_t phys = pmm_alloc_frame_color(pmm_page_color(virt));
+    if (!phys) return 0;
+
+    vmm_map_page(virt, phys, flags);
+    return phys;
+}
+
+// map one 4MB page with a single PDE
+int vmm_map_large(uint32_t virt, uint32_t phys, uint32_t flags) {
+
+    if (!large_pages) return -1;                                                // no PSE: 4KB path
+    if ((virt | phys) & ~VMM_LARGE_MASK) return -1;                             // both ends must be 4MB aligned
+    if (virt < KERNEL_VIRT_BASE) return -1;                                     // user half stays 4KB (copy-on-write granularity)
+
+    uint32_t pd_idx = PD_INDEX(virt);
+    if (current_directory[pd_idx] & VMM_PRESENT) return -1;                     // already has a table or page
+
+    uint32_t pde = phys | (flags & (VMM_WRITABLE | VMM_WRITETHRU | VMM_NOCACHE)) | VMM_PRESENT | VMM_LARGE;
+
+    set_kernel_pde(pd_idx, pde | global_flag);                                  // kernel half: every address space
+
+    tlb_flush_page(virt);
+    return 0;
+}
+
+void vmm_unmap_large(uint32_t virt) {
+
+    uint32_t pd_idx = PD_INDEX(virt);
+    if (!(current_directory[pd_idx] & VMM_LARGE))
+        return;
+
+    set_kernel_pde(pd_idx, 0);
+
+    tlb_flush_page(virt);                                                       // one invlpg drops the whole 4MB entry
+}
+
+int vmm_has_large_pages(void) {
+    return large_pages;
 }
 
 // remove single virtual page mapping
 void vmm_unmap_page(uint32_t virt) {
 
     uint32_t pd_idx = PD_INDEX(virt);                               // page table existence check
-    if (!(page_directory[pd_idx] & VMM_PRESENT))
+    if (!(current_directory[pd_idx] & VMM_PRESENT))
+        return;
+
+    if (current_directory[pd_idx] & VMM_LARGE) {                    // part of a 4MB page: use vmm_unmap_large
+        kprintf("VMM: vmm_unmap_page — %p is inside a 4MB page\n", virt);
         return;
+    }
 
-    uint32_t *pt = (uint32_t *)(page_directory[pd_idx] & VMM_ADDR_MASK);        // return page table
-    pt[PT_INDEX(virt)] = 0;                                                     // clear page table entry
+    *pte_of(virt) = 0;                                                          // clear page table entry
 
     tlb_flush_page(virt);
 }
@@ -82,11 +388,13 @@ void vmm_unmap_page(uint32_t virt) {
 uint32_t vmm_get_phys(uint32_t virt) {
 
     uint32_t pd_idx = PD_INDEX(virt);                               // PDE check
-    if (!(page_directory[pd_idx] & VMM_PRESENT))
+    if (!(current_directory[pd_idx] & VMM_PRESENT))
         return 0;
-    
-    uint32_t *pt = (uint32_t *)(page_directory[pd_idx] & VMM_ADDR_MASK);        // PTE check
-    uint32_t pte = pt[PT_INDEX(virt)];
+
+    if (current_directory[pd_idx] & VMM_LARGE)                                  // 4MB page: offset = low 22 bits
+        return (current_directory[pd_idx] & VMM_LARGE_MASK) | (virt & ~VMM_LARGE_MASK);
+
+    uint32_t pte = *pte_of(virt);                                               // PTE check
     if (!(pte & VMM_PRESENT))
         return 0;
 
@@ -98,49 +406,553 @@ uint32_t vmm_get_phys(uint32_t virt) {
 int vmm_is_mapped(uint32_t virt) {
 
     uint32_t pd_idx = PD_INDEX(virt);                                           // PDE check
-    if (!(page_directory[pd_idx] & VMM_PRESENT))
+    if (!(current_directory[pd_idx] & VMM_PRESENT))
+        return 0;
+
+    if (current_directory[pd_idx] & VMM_LARGE)                                  // 4MB page
+        return 1;
+
+    return (*pte_of(virt) & VMM_PRESENT) ? 1 : 0;                          // return 1 if VMM_PRESENT
+
+}
+
+// ADDRESS SPACES
+
+uint32_t *vmm_create_address_space(void) {
+
+    uint32_t pd_phys = pmm_alloc_zeroed_frame_zone(PMM_ZONE_DMA);              // zeroed = user half empty
+                                                                                // DMA zone: set_kernel_pde writes every directory through the direct map
+    if (pd_phys == 0) {
+        kprintf("VMM: Out of physical memory for page directory\n");
+        return 0;
+    }
+
+    uint32_t *pd = (uint32_t *)P2V(pd_phys);
+
+    uint32_t flags = cpu_irq_save();                                            // no kernel PDE may change mid-copy
+
+    if (space_count == VMM_MAX_SPACES) {
+        cpu_irq_restore(flags);
+        kprintf("VMM: Address space table full\n");
+        pmm_free_frame(pd_phys);
+        return 0;
+    }
+
+    for (uint32_t i = KERNEL_PDE; i < VMM_RECURSIVE_PDE; i++)                   // kernel half: same page tables, not copies
+        pd[i] = page_directory[i];
+    pd[VMM_RECURSIVE_PDE] = pd_phys | VMM_KERNEL_RW;                             // own tables at VMM_PT_BASE while loaded
+
+    spaces[space_count++] = pd;
+
+    cpu_irq_restore(flags);
+    return pd;
+}
+
+void vmm_destroy_address_space(uint32_t *pd) {
+
+    if (!pd || pd == page_directory) return;
+
+    uint32_t flags = cpu_irq_save();
+
+    if (current_directory == pd)                                                // never free the live directory
+        vmm_switch(0);
+
+    uint32_t i = 0;
+    while (i < space_count && spaces[i] != pd) i++;
+    if (i == space_count) {
+        cpu_irq_restore(flags);
+        kprintf("VMM: vmm_destroy_address_space — unknown directory %p\n", (uint32_t)pd);
+        return;
+    }
+    spaces[i] = spaces[--space_count];
+
+    cpu_irq_restore(flags);
+
+    for (uint32_t t = 0; t < KERNEL_PDE; t++) {                                 // user half: tables + the frames they map
+
+        if (!(pd[t] & VMM_PRESENT)) continue;
+
+        uint32_t pt_phys = pd[t] & VMM_ADDR_MASK;
+
+        flags = cpu_irq_save();
+        uint32_t *pt = temp_map(pt_phys);                                       // not loaded: no recursive view
+        for (uint32_t e = 0; e < 1024; e++)
+            if (pt[e] & VMM_PRESENT)
+                pmm_frame_unref(pt[e] & VMM_ADDR_MASK);                         // shared (copy-on-write) frames survive
+        temp_unmap();
+        cpu_irq_restore(flags);
+
+        pmm_free_frame(pt_phys);
+    }
+
+    pmm_free_frame(V2P(pd));
+}
+
+// copy of the current address space: user pages shared read-only until first write, kernel half by reference
+uint32_t *vmm_clone_address_space(void) {
+
+    uint32_t *pd = vmm_create_address_space();
+    if (!pd) return 0;
+
+    for (uint32_t t = 0; t < KERNEL_PDE; t++) {
+
+        uint32_t pde = current_directory[t];
+        if (!(pde & VMM_PRESENT)) continue;
+
+        uint32_t pt_phys = pmm_alloc_frame();                                   // every entry written below: no zeroing
+        if (!pt_phys) {
+            kprintf("VMM: Out of physical memory cloning address space\n");
+            vmm_destroy_address_space(pd);                                      // drops the references taken so far
+            switch_page_directory(V2P(current_directory));
+            return 0;
+        }
+
+        uint32_t *src = pt_of(t);                                               // parent = current directory
+
+        uint32_t flags = cpu_irq_save();
+        uint32_t *dst = temp_map(pt_phys);
+
+        for (uint32_t e = 0; e < 1024; e++) {
+
+            uint32_t pte = src[e];
+            if (pte & VMM_PRESENT) {
+
+                if (pte & VMM_WRITABLE)                                         // both sides read-only: first write copies
+                    pte = (pte & ~VMM_WRITABLE) | VMM_COW;
+
+                src[e] = pte;
+                pmm_frame_ref(pte & VMM_ADDR_MASK);
+            }
+            dst[e] = pte;
+        }
+
+        temp_unmap();
+        cpu_irq_restore(flags);
+
+        pd[t] = pt_phys | (pde & ~VMM_ADDR_MASK);
+    }
+
+    switch_page_directory(V2P(current_directory));                              // drop the parent's writable TLB entries
+    return pd;
+}
+
+void vmm_switch(uint32_t *pd) {
+
+    if (!pd) pd = page_directory;
+    if (pd == current_directory) return;                                        // same address space: keep the TLB
+
+    current_directory = pd;
+    switch_page_directory(V2P(pd));                                             // global (kernel) TLB entries survive
+}
+
+// zero a 4KB physical frame
+void vmm_zero_frame(uint32_t phys) {
+
+    if (phys < PMM_DMA_LIMIT) {                                                 // direct mapped: no window needed
+        uint32_t *p = (uint32_t *)P2V(phys & VMM_ADDR_MASK);
+        for (int i = 0; i < 1024; i++)
+            p[i] = 0;
+        return;
+    }
+
+    uint32_t flags = cpu_irq_save();
+
+    uint32_t *p = temp_map(phys);
+    for (int i = 0; i < 1024; i++)
+        p[i] = 0;
+    temp_unmap();
+
+    cpu_irq_restore(flags);
+}
+
+// write to a present page: copy-on-write break, 0 = handled
+static int fault_cow(uint32_t addr) {
+
+    uint32_t pde = current_directory[PD_INDEX(addr)];
+    if (!(pde & VMM_PRESENT) || (pde & VMM_LARGE))
+        return -1;
+
+    uint32_t *pte = pte_of(addr);
+    if (!(*pte & VMM_COW))
+        return -1;
+
+    uint32_t page  = addr & VMM_ADDR_MASK;
+    uint32_t old   = *pte & VMM_ADDR_MASK;
+    uint32_t flags = (*pte & (VMM_PRESENT | VMM_USER | VMM_WRITETHRU | VMM_NOCACHE)) | VMM_WRITABLE;
+
+    if (pmm_frame_refcount(old) == 1) {                                         // every other sharer is gone: keep the frame
+        *pte = old | flags;
+        tlb_flush_page(page);
         return 0;
+    }
+
+    uint32_t copy = pmm_alloc_frame_color(pmm_page_color(page));
+    if (!copy) {
+        kprintf("VMM: Out of physical memory for copy-on-write at %p\n", addr);
+        return -1;
+    }
+
+    const uint32_t *src = (const uint32_t *)page;                               // still mapped read-only
+    uint32_t *dst = temp_map(copy);
+    for (int i = 0; i < 1024; i++)
+        dst[i] = src[i];
+    temp_unmap();
+
+    *pte = copy | flags;
+    tlb_flush_page(page);
+
+    pmm_frame_unref(old);                                                       // one sharer less
+    return 0;
+}
+
+// access to an unmapped page: zero-fill it if a region covers it, 0 = handled
+static int fault_zero_fill(uint32_t addr, uint32_t err, vmm_region_t *regions) {
+
+    vmm_region_t *r = vmm_region_find(regions, addr);
+    if (!r) return -1;                                                          // outside every region
+    if ((err & VMM_PF_WRITE) && !(r->flags & VMM_WRITABLE)) return -1;          // write to a read-only region
+
+    uint32_t frame = pmm_alloc_zeroed_frame();                                  // idle-time zeroed pool first
+    if (!frame) {
+        kprintf("VMM: Out of physical memory for demand page at %p\n", addr);
+        return -1;
+    }
+
+    if (vmm_try_map_page(addr & VMM_ADDR_MASK, frame, r->flags) != 0) {        // no frame for the page table: not fatal here
+        pmm_free_frame(frame);
+        kprintf("VMM: Out of physical memory for page table at %p\n", addr);
+        return -1;
+    }
+    return 0;
+}
+
+// page fault (interrupts off): 0 = resolved (retry the instruction), -1 = genuine fault
+int vmm_handle_fault(uint32_t addr, uint32_t err, vmm_region_t *regions) {
+
+    if (addr >= KERNEL_VIRT_BASE) return -1;                                    // kernel half is never demand paged
+
+    if (!(err & VMM_PF_PRESENT))
+        return fault_zero_fill(addr, err, regions);
+
+    if (err & VMM_PF_WRITE)
+        return fault_cow(addr);
+
+    return -1;
+}
+
+// REGIONS
+
+int vmm_region_add(vmm_region_t **list, uint32_t start, uint32_t length, uint32_t flags) {
+
+    uint32_t end = (start + length + PAGE_SIZE - 1) & VMM_ADDR_MASK;
+
+    if ((start & ~VMM_ADDR_MASK) || !length || end <= start || end > KERNEL_VIRT_BASE) {
+        kprintf("VMM: vmm_region_add — bad range %p + %u\n", start, length);
+        return -1;
+    }
+
+    vmm_region_t **link = list;                                                 // sorted insert, no overlap
+    while (*link && (*link)->end <= start)
+        link = &(*link)->next;
+    if (*link && (*link)->start < end) {
+        kprintf("VMM: vmm_region_add — %p - %p overlaps a region\n", start, end);
+        return -1;
+    }
+
+    vmm_region_t *r = (vmm_region_t *)kmem_cache_alloc(region_cache);
+    if (!r) return -1;
 
-    uint32_t *pt = (uint32_t *)(page_directory[pd_idx] & VMM_ADDR_MASK);        // PTE check
-    return (pt[PT_INDEX(virt)] & VMM_PRESENT) ? 1 : 0;                          // return 1 if VMM_PRESENT
+    r->start = start;
+    r->end   = end;
+    r->flags = flags & (VMM_WRITABLE | VMM_USER | VMM_WRITETHRU | VMM_NOCACHE);
+    r->next  = *link;
+    *link    = r;
+    return 0;
+}
+
+vmm_region_t *vmm_region_find(vmm_region_t *list, uint32_t addr) {
+
+    for (vmm_region_t *r = list; r && r->start <= addr; r = r->next)
+        if (addr < r->end) return r;
+    return 0;
+}
+
+int vmm_region_remove(vmm_region_t **list, uint32_t *pd, uint32_t start) {
+
+    vmm_region_t **link = list;
+    while (*link && (*link)->start != start)
+        link = &(*link)->next;
+    if (!*link) return -1;
+
+    vmm_region_t *r = *link;
+    *link = r->next;
+
+    vmm_release_range(pd, r->start, r->end);                                    // pages touched so far
+    kmem_cache_free(region_cache, r);
+    return 0;
+}
+
+int vmm_region_clone(vmm_region_t **dst, const vmm_region_t *src) {
+
+    vmm_region_t **link = dst;
+
+    for (; src; src = src->next) {
+        vmm_region_t *r = (vmm_region_t *)kmem_cache_alloc(region_cache);
+        if (!r) {
+            vmm_region_free_all(dst);
+            return -1;
+        }
+        *r    = *src;
+        r->next = 0;
+        *link = r;
+        link  = &r->next;
+    }
+
+    return 0;
+}
+
+void vmm_region_free_all(vmm_region_t **list) {
+
+    while (*list) {
+        vmm_region_t *r = *list;
+        *list = r->next;
+        kmem_cache_free(region_cache, r);
+    }
+}
 
+void vmm_release_range(uint32_t *pd, uint32_t start, uint32_t end) {
+
+    if (!pd) pd = page_directory;
+    if (end > KERNEL_VIRT_BASE) end = KERNEL_VIRT_BASE;                         // user half only
+
+    int live = (pd == current_directory);                                       // loaded: recursive view + invlpg
+
+    uint32_t va = start & VMM_ADDR_MASK;
+    while (va < end) {
+
+        uint32_t pd_idx = PD_INDEX(va);
+        uint32_t stop   = table_end(va, end);                                   // one page table = 4MB
+
+        if (!(pd[pd_idx] & VMM_PRESENT)) {                                      // no table: skip to the next 4MB
+            va = stop;
+            continue;
+        }
+
+        uint32_t flags = cpu_irq_save();
+        uint32_t *pt = live ? pt_of(pd_idx) : temp_map(pd[pd_idx]);
+
+        for (; va < stop; va += PAGE_SIZE) {
+
+            uint32_t *pte = &pt[PT_INDEX(va)];
+            if (!(*pte & VMM_PRESENT)) continue;
+
+            uint32_t frame = *pte & VMM_ADDR_MASK;
+            *pte = 0;
+            if (live)
+                tlb_flush_page(va);
+            pmm_frame_unref(frame);
+        }
+
+        if (!live) temp_unmap();
+        cpu_irq_restore(flags);
+    }
+}
+
+// turn on CR4.PSE / CR4.PGE if the CPU has them: 4MB pages for the kernel, kernel PTEs carry VMM_GLOBAL
+static void vmm_enable_features(void) {
+
+    uint32_t a, b, c, d;
+    cpu_cpuid(1, 0, &a, &b, &c, &d);
+
+    if (d & CPUID_EDX_PSE) {
+        set_cr4(get_cr4() | CR4_PSE);
+        large_pages = 1;
+        kprintf("VMM: CR4.PSE enabled - 4MB pages available\n");
+    } else {
+        kprintf("VMM: CPU has no 4MB pages (PSE), kernel uses 4KB pages only\n");
+    }
+
+    if (d & CPUID_EDX_PGE) {
+        set_cr4(get_cr4() | CR4_PGE);
+        global_flag = VMM_GLOBAL;
+        kprintf("VMM: CR4.PGE enabled - kernel mappings are global\n");
+    } else {
+        kprintf("VMM: CPU has no global pages (PGE), kernel TLB entries flushed on every switch\n");
+    }
 }
 
 void vmm_init(void) {
 
     kprintf("VMM: Initialising virtual memory manager \n");
 
-    // allocate & zero page directory
-    uint32_t pd_phys = pmm_alloc_frame();                                       // pd = 4KB frame
+    vmm_enable_features();
+
+    // allocate & zero page directory (DMA zone = reachable through the direct map, boot.asm maps it too)
+    uint32_t pd_phys = pmm_alloc_frame_zone(PMM_ZONE_DMA);                      // pd = 4KB frame
     if (pd_phys == 0)
         panic("VMM: Cannot allocate page directory frame ");
-    
-    page_directory = (uint32_t *)pd_phys;                                       // store pd pointer
 
-    for (int i = 0; i < 1024; i++)                                              // zero all entries in pd
+    page_directory    = (uint32_t *)P2V(pd_phys);                               // store pd pointer
+    current_directory = page_directory;
+
+    for (int i = 0; i < 1024; i++)                                              // zero all entries in pd (boot identity map dropped)
         page_directory[i] = 0;
 
-    // identity mapping first 4MB
-    kprintf("VMM: Identity mapping first 4MB (kernel + VGA + low memory)\n");
+    // direct map of the whole DMA zone (first 16MB) at KERNEL_VIRT_BASE - kernel image, VGA, page tables and directories live there
+    kprintf("VMM: Mapping first 16MB at %p (kernel + VGA + DMA zone) with %s pages\n",
+            KERNEL_VIRT_BASE, large_pages ? "4MB" : "4KB");
+
+    uint32_t pt0_phys = 0;
+
+    for (uint32_t t = 0; t < PD_INDEX(PMM_DMA_LIMIT); t++) {
+
+        if (large_pages) {                                                      // one PDE per 4MB, no page table
+            page_directory[KERNEL_PDE + t] = (t * VMM_LARGE_SIZE) | VMM_KERNEL_RW | VMM_LARGE | global_flag;
+            continue;
+        }
 
-    uint32_t pt0_phys = pmm_alloc_frame();                                      // allocate first page table
-    if (pt0_phys == 0)
-        panic("VMM: Cannot allocate page table 0 frame");
+        uint32_t pt_phys = pmm_alloc_frame_zone(PMM_ZONE_DMA);                  // 4KB fallback: allocate direct map page table
+        if (pt_phys == 0)
+            panic("VMM: Cannot allocate direct map page table frame");
+        if (t == 0) pt0_phys = pt_phys;
+
+        uint32_t *pt = (uint32_t *)P2V(pt_phys);                                // pt t = virtual addresses ( BASE + t*4MB - BASE + t*4MB + 0x003FFFFF )
+
+        for (int i = 0; i < 1024; i++) {                                        // fill page table
+            pt[i] = (t * 1024u + (uint32_t)i) * PAGE_SIZE | VMM_KERNEL_RW | global_flag;    // phys frame number -> virt page
+        }                                                                       // mark pages present, writable & global
+
+        // install page table -> PD[KERNEL_PDE + t]
+        page_directory[KERNEL_PDE + t] = pt_phys | VMM_KERNEL_RW;
+    }
 
-    uint32_t *pt0 = (uint32_t *)pt0_phys;                                       // pt0 = virtual addresses ( 0x00000000 - 0x003FFFFF )
+    // recursive slot: the directory doubles as the page table of the top 4MB (not global, differs per address space)
+    page_directory[VMM_RECURSIVE_PDE] = pd_phys | VMM_KERNEL_RW;
 
-    for (int i = 0; i < 1024; i++) {                                            // fill first page table
-        pt0[i] = ((uint32_t)i * PAGE_SIZE) | VMM_KERNEL_RW;                     // phys frame number -> virt page
-    }                                                                           // mark pages present & writable
+    region_cache = kmem_cache_create("vmm_region", sizeof(vmm_region_t), 0, 0);    // no memory yet: slabs come later, from kpage_alloc
+    if (!region_cache)
+        panic("VMM: Cannot create region cache");
 
-    // install page table -> PD[0]
-    page_directory[0] = pt0_phys | VMM_KERNEL_RW;
+    kprintf("VMM: Loading CR3 (leaving the boot page tables)\n");
+    switch_page_directory(pd_phys);
+    kprintf("VMM: Kernel directory active, page tables at %p\n", VMM_PT_BASE);
 
-    kprintf("VMM: Loading CR3 and enabling paging\n");
-    enable_paging(pd_phys);
-    kprintf("VMM: Paging enabled\n");
+    if (!create_table(VMM_TEMP_WINDOW, VMM_KERNEL_RW))                          // page table holding the scratch window PTEs
+        panic("VMM: Cannot allocate temp window page table");
+    temp_ready = 1;
 
-    kprintf("VMM: Page directory @ %p  |  Page table 0 @ %p\n", pd_phys, pt0_phys);
+    if (pt0_phys)
+        kprintf("VMM: Page directory @ %p  |  Page table 0 @ %p\n", pd_phys, pt0_phys);
+    else
+        kprintf("VMM: Page directory @ %p  |  direct map = %u x 4MB pages\n", pd_phys, PD_INDEX(PMM_DMA_LIMIT));
     kprintf("VMM: Ready\n\n");
 
-}
\ No newline at end of file
+}
+
+#ifdef ORION_BENCH
+
+// boot-time microbenchmark (make BENCH=1): CR3 switch between two address spaces followed by kernel work
+// (touching VMM_BENCH_PAGES pages of the kernel image), with global kernel pages off vs on
+
+#define VMM_BENCH_ROUNDS    4096            // address space switches per measurement
+#define VMM_BENCH_PAGES     32              // kernel pages touched after each switch
+
+extern uint8_t kernel_start;
+
+static uint32_t vmm_bench_switches(uint32_t *a, uint32_t *b) {
+
+    volatile uint8_t *kernel = (volatile uint8_t *)&kernel_start;
+    uint32_t sum = 0;
+
+    uint64_t t0 = rdtsc();
+    for (uint32_t r = 0; r < VMM_BENCH_ROUNDS; r++) {
+        vmm_switch((r & 1) ? b : a);
+        for (uint32_t p = 0; p < VMM_BENCH_PAGES; p++)
+            sum += kernel[p * PAGE_SIZE];
+    }
+    uint64_t cycles = rdtsc() - t0;
+
+    (void)sum;
+    return (uint32_t)(cycles / VMM_BENCH_ROUNDS);
+}
+
+// map / unmap VMM_BENCH_RANGE bytes of user space (backed by the direct-mapped DMA zone, never written):
+// one vmm_map_page / vmm_unmap_page per page vs the batched range calls
+#define VMM_BENCH_RANGE     PMM_DMA_LIMIT   // 16MB = 4096 pages
+#define VMM_BENCH_VIRT      0x40000000u
+
+static void vmm_bench_range(void) {
+
+    uint32_t *space = vmm_create_address_space();
+    if (!space) return;
+
+    uint32_t flags = cpu_irq_save();
+    vmm_switch(space);
+
+    vmm_map_range(VMM_BENCH_VIRT, 0, VMM_BENCH_RANGE, VMM_PRESENT);             // page tables allocated up front
+    vmm_unmap_range(VMM_BENCH_VIRT, VMM_BENCH_RANGE);
+
+    uint64_t t0 = rdtsc();
+    for (uint32_t off = 0; off < VMM_BENCH_RANGE; off += PAGE_SIZE)
+        vmm_map_page(VMM_BENCH_VIRT + off, off, VMM_PRESENT);
+    uint64_t t1 = rdtsc();
+    for (uint32_t off = 0; off < VMM_BENCH_RANGE; off += PAGE_SIZE)
+        vmm_unmap_page(VMM_BENCH_VIRT + off);
+    uint64_t t2 = rdtsc();
+    vmm_map_range(VMM_BENCH_VIRT, 0, VMM_BENCH_RANGE, VMM_PRESENT);             // fresh entries: no invalidation at all
+    uint64_t t3 = rdtsc();
+    vmm_protect_range(VMM_BENCH_VIRT, VMM_BENCH_RANGE, VMM_PRESENT | VMM_NOCACHE);  // every entry changes: one CR3 reload
+    uint64_t t4 = rdtsc();
+    vmm_unmap_range(VMM_BENCH_VIRT, VMM_BENCH_RANGE);
+    uint64_t t5 = rdtsc();
+
+    vmm_switch(0);
+    cpu_irq_restore(flags);
+
+    kprintf("VMM: bench %u pages (kcycles): per-page map %u unmap %u | batched map %u protect %u unmap %u\n",
+            VMM_BENCH_RANGE / PAGE_SIZE,
+            (uint32_t)((t1 - t0) / 1000), (uint32_t)((t2 - t1) / 1000),
+            (uint32_t)((t3 - t2) / 1000), (uint32_t)((t4 - t3) / 1000), (uint32_t)((t5 - t4) / 1000));
+
+    vmm_destroy_address_space(space);                                           // only the empty page tables left
+}
+
+void vmm_bench(void) {
+
+    uint32_t *a = vmm_create_address_space();
+    uint32_t *b = vmm_create_address_space();
+    if (!a || !b) {
+        vmm_destroy_address_space(a);
+        vmm_destroy_address_space(b);
+        return;
+    }
+
+    uint32_t flags = cpu_irq_save();
+    uint32_t cr4   = get_cr4();
+
+    set_cr4(cr4 & ~CR4_PGE);                                                    // clearing PGE also drops every global entry
+    uint32_t local = vmm_bench_switches(a, b);
+
+    uint32_t global = 0;
+    if (global_flag) {
+        set_cr4(cr4 | CR4_PGE);
+        global = vmm_bench_switches(a, b);
+    }
+
+    set_cr4(cr4);
+    vmm_switch(0);
+    cpu_irq_restore(flags);
+
+    if (global_flag)
+        kprintf("VMM: bench switch + %u kernel pages: %u cycles non-global, %u cycles global\n",
+                VMM_BENCH_PAGES, local, global);
+    else
+        kprintf("VMM: bench switch + %u kernel pages: %u cycles (no PGE)\n", VMM_BENCH_PAGES, local);
+
+    vmm_destroy_address_space(a);
+    vmm_destroy_address_space(b);
+
+    vmm_bench_range();
+}
+
+#endif
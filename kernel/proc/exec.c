@@ -28,10 +28,12 @@ int proc_exec(pcb_t *p, uint32_t new_entry) {
     proc_init_frame(p, new_entry);
 
     // reset accounting and re-arm full timeslice
-    p->ticks_total     = 0;
+    p->ns_total        = 0;
     p->ticks_scheduled = 0;
+    p->ns_wake_max     = 0;
     p->timeslice       = p->timeslice_len;
     p->wakeup_tick     = 0;
+    p->wakeup_ns       = 0;
     p->waiting         = 0;
 
     p->state = PROC_READY;                                              // mark process ready again
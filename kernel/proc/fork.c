@@ -3,6 +3,8 @@
 #include "proc.h"
 #include "sched.h"
 #include "kprintf.h"
+#include "vmm.h"
+#include "pmm.h"
 
 // create new process
 pid_t proc_fork(uint32_t child_entry) {
@@ -23,6 +25,15 @@ pid_t proc_fork(uint32_t child_entry) {
 
     // wire parent-child relationship
     if (parent) child->ppid = parent->pid;
+    if (parent) child->vruntime = parent->vruntime;                                 // no fresh credit from forking
+
+    child->page_directory = vmm_clone_address_space();                              // parent's user pages copy-on-write, shared kernel half
+    if (!child->page_directory || vmm_region_clone(&child->regions, parent ? parent->regions : 0) != 0) {
+        kprintf("PROC: proc_fork — no address space for child\n");
+        child->state = PROC_ZOMBIE;
+        proc_destroy(child);
+        return PID_INVALID;
+    }
 
     proc_init_frame(child, child_entry);                                            // build child stack frame
     proc_set_ready(child);                                                          // child = runnable
@@ -33,4 +44,50 @@ pid_t proc_fork(uint32_t child_entry) {
             parent ? (uint32_t)parent->pid : 0u);
 
     return child->pid;                                                              // return to parent
-}
\ No newline at end of file
+}
+
+#ifdef ORION_BENCH
+
+// boot-time fork storm (make BENCH=1): PROC_BENCH_FORKS children forked then destroyed together
+// kernel stacks (kpage), regions (slab), directories / page tables (PMM) - free frames should come back
+// (slack: one CPU magazine of frames and the empty slab each cache keeps)
+
+#define PROC_BENCH_FORKS    64
+#define PROC_BENCH_SLACK    (PMM_CACHE_SIZE + 8)
+
+static pcb_t *proc_bench_child[PROC_BENCH_FORKS];
+
+static void proc_bench_entry(void) {                                                // never scheduled
+    for (;;) asm volatile ("hlt");
+}
+
+void proc_fork_bench(void) {
+
+    uint32_t before = pmm_get_free_frames();
+
+    uint32_t forked = 0;
+    while (forked < PROC_BENCH_FORKS) {
+        pid_t pid = proc_fork((uint32_t)proc_bench_entry);
+        if (pid == PID_INVALID) break;
+        proc_bench_child[forked++] = proc_get(pid);
+    }
+
+    uint32_t peak = pmm_get_free_frames();
+
+    for (uint32_t i = 0; i < forked; i++) {                                         // exit order = creation order
+        pcb_t *child = proc_bench_child[i];
+        sched_remove(child);
+        child->state = PROC_ZOMBIE;
+        proc_destroy(child);
+    }
+
+    uint32_t after = pmm_get_free_frames();
+
+    kprintf("PROC: fork storm %u procs: free frames %u before, %u at peak, %u after\n",
+            forked, before, peak, after);
+
+    if (after + PROC_BENCH_SLACK < before)
+        kprintf("PROC: WARNING — %u frames not returned after the storm\n", before - after);
+}
+
+#endif
@@ -0,0 +1,44 @@
+// mmap.c - proc_mmap / proc_munmap
+
+#include "proc.h"
+#include "vmm.h"
+#include "kprintf.h"
+
+// reserve a user range: no frames now, each page is zero-filled by the page-fault path on first touch
+int proc_mmap(pcb_t *p, uint32_t start, uint32_t length, uint32_t flags) {
+
+    if (!p) {
+        kprintf("PROC: proc_mmap — NULL pcb\n");
+        return -1;
+    }
+
+    // kernel threads share the kernel directory: their pages would leak into every other kernel thread
+    if (!p->page_directory) {
+        kprintf("PROC: proc_mmap — [%u] has no private address space\n", (uint32_t)p->pid);
+        return -1;
+    }
+
+    if (vmm_region_add(&p->regions, start, length, flags) != 0) {
+        kprintf("PROC: proc_mmap — [%u] cannot add %p + %u\n", (uint32_t)p->pid, start, length);
+        return -1;
+    }
+
+    kprintf("PROC: proc_mmap — [%u] \"%s\" %p + %u (demand zero)\n", (uint32_t)p->pid, p->name, start, length);
+    return 0;
+}
+
+// drop a range added by proc_mmap together with the pages touched in it
+int proc_munmap(pcb_t *p, uint32_t start) {
+
+    if (!p) {
+        kprintf("PROC: proc_munmap — NULL pcb\n");
+        return -1;
+    }
+
+    if (vmm_region_remove(&p->regions, p->page_directory, start) != 0) {
+        kprintf("PROC: proc_munmap — [%u] no region at %p\n", (uint32_t)p->pid, start);
+        return -1;
+    }
+
+    return 0;
+}
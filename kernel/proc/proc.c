@@ -1,12 +1,14 @@
 // Process Control Block - Orion OS
 
 #include "proc.h"
-#include "kheap.h"
+#include "kpage.h"
 #include "timer.h"
 #include "kprintf.h"
 #include "panic.h"
 #include "string.h"
 #include "sched.h"
+#include "vmm.h"
+#include "cpu.h"
 
 static pcb_t proc_table[MAX_PROCS];                                                                     // fixed size array
 
@@ -88,7 +90,7 @@ pcb_t *proc_create(const char *name, uint8_t priority) {
         return 0;
     }
 
-    uint8_t *kstack = (uint8_t *)kmalloc_aligned(KSTACK_SIZE);                  // allocate kernel stack
+    uint8_t *kstack = (uint8_t *)kpage_alloc(KSTACK_SIZE / PAGE_SIZE);          // allocate kernel stack (whole frames, no heap block)
 
     if (!kstack) {
         kprintf("PROC: proc_create — OOM allocating kernel stack\n");
@@ -123,11 +125,17 @@ pcb_t *proc_create(const char *name, uint8_t priority) {
     p->esp_kernel  = 0;
 
     p->page_directory = 0; 
+    p->regions        = 0;
+    p->minor_faults   = 0;
 
     if (priority > PROC_PRIO_IDLE) priority = PROC_PRIO_IDLE;
     p->priority      = priority;
     p->base_priority = priority;
 
+    p->rq_next = 0;
+    p->rq_prev = 0;
+    p->on_rq   = 0;
+
     uint32_t tslice = PROC_TIMESLICE_DEFAULT;
     if      (priority < PROC_PRIO_NORMAL)
         tslice = PROC_TIMESLICE_DEFAULT + (PROC_PRIO_NORMAL - priority) / 2u;
@@ -138,11 +146,17 @@ pcb_t *proc_create(const char *name, uint8_t priority) {
     p->timeslice_len = tslice;
     p->timeslice     = tslice;
 
-    p->ticks_total     = 0;
+    p->ns_total        = 0;
     p->ticks_scheduled = 0;
-    p->tick_last_run   = 0;
-    p->tick_created    = timer_get_ticks();
+    p->ns_last_run     = 0;
+    p->ns_created      = clock_ns();
+    p->ns_woken        = 0;
+    p->ns_wake_max     = 0;
+    p->vruntime        = 0;                                     // placed near the fair clock when first queued
     p->wakeup_tick     = 0;
+    p->wakeup_ns       = 0;
+    p->sleep_timer.next  = 0;
+    p->sleep_timer.pprev = 0;
 
     p->wait_for_pid    = PID_INVALID;
     p->waiting         = 0;
@@ -220,14 +234,23 @@ void proc_destroy(pcb_t *p) {
 
     kprintf("PROC: destroying [%u] \"%s\"\n", (uint32_t)p->pid, p->name);
 
+    ktimer_cancel(&p->sleep_timer);                             // PCB is about to be wiped: no timer may point into it
+
     if (p->kstack_base) {
-        kfree_aligned(p->kstack_base);
+        kpage_free(p->kstack_base, KSTACK_SIZE / PAGE_SIZE);
         p->kstack_base = 0;
         p->kstack_top  = 0;
         p->esp0        = 0;
         p->esp_kernel  = 0;
     }
 
+    vmm_region_free_all(&p->regions);
+
+    if (p->page_directory) {                                    // private address space dies with the process
+        vmm_destroy_address_space(p->page_directory);
+        p->page_directory = 0;
+    }
+
     pid_free(p->pid);
 
     pid_t saved_pid = p->pid;
@@ -262,8 +285,14 @@ const char *proc_state_name(proc_state_t s) {
 void proc_set_priority(pcb_t *p, uint8_t priority) {
     if (!p) return;
     if (priority > PROC_PRIO_IDLE) priority = PROC_PRIO_IDLE;
+
+    int queued = p->on_rq;                                      // run queue index = priority: move to the new queue
+    if (queued) sched_remove(p);
+
     p->priority      = priority;
     p->base_priority = priority;
+
+    if (queued) sched_add(p);
 }
 
 // set time slice
@@ -286,14 +315,22 @@ void proc_dump(const pcb_t *p) {
     kprintf("  |  timeslice    = %u / %u ticks\n", p->timeslice, p->timeslice_len);
     kprintf("  |  kstack_base  = %p  top = %p\n", (uint32_t)p->kstack_base, p->kstack_top);
     kprintf("  |  esp0         = %p\n",     p->esp0);
+    kprintf("  |  page dir     = %p%s\n",   (uint32_t)p->page_directory, p->page_directory ? "" : " (kernel)");
     kprintf("  |  esp_kernel  = 0x%p\n",    p->esp_kernel);
     kprintf("  |  eip          = %p  eflags = %p\n", p->context.eip, p->context.eflags);
-    kprintf("  |  ticks_total  = %u  scheduled = %ux\n", p->ticks_total, p->ticks_scheduled);
-    kprintf("  |  created tick = %u\n",     p->tick_created);
+    kprintf("  |  run time     = %u us  scheduled = %ux\n", (uint32_t)(p->ns_total / 1000u), p->ticks_scheduled);
+    kprintf("  |  wake latency = %u us max\n", (uint32_t)(p->ns_wake_max / 1000u));
+    if (PROC_PRIO_IS_FAIR(p->priority))
+        kprintf("  |  vruntime     = %u us\n", (uint32_t)(p->vruntime / 1000u));
+    kprintf("  |  minor faults = %u\n",     p->minor_faults);
+    kprintf("  |  created      = %u us\n",  (uint32_t)(p->ns_created / 1000u));
 
     if (p->state == PROC_BLOCKED && p->wakeup_tick) {
         kprintf("  |  wakeup_tick  = %u\n", p->wakeup_tick);
     }
+    if (p->state == PROC_BLOCKED && p->wakeup_ns) {
+        kprintf("  |  wakeup at    = %u us\n", (uint32_t)(p->wakeup_ns / 1000u));
+    }
     if (p->state == PROC_ZOMBIE) {
         kprintf("  |  exit_code    = %u\n", (uint32_t)p->exit_code);
     }
@@ -379,18 +416,44 @@ pid_t proc_wait(pid_t pid, int32_t *out_code) {
     }
 }
 
+// sleep timer fired (IRQ0)
+static void proc_sleep_expired(void *arg) {
+    proc_wake((pcb_t *)arg);
+}
+
 void proc_sleep(uint32_t ticks) {
 
     pcb_t *p = sched_current();
     if (!p || ticks == 0) return;
 
+    kprintf("PROC: [%u] \"%s\" sleeping for %u ticks (wake at %u)\n",
+            (uint32_t)p->pid, p->name, ticks, timer_get_ticks() + ticks);
+
+    uint32_t flags = cpu_irq_save();                            // BLOCKED before the timer can fire
+
     p->wakeup_tick = timer_get_ticks() + ticks;
     p->state       = PROC_BLOCKED;
+    sched_remove(p);
+    ktimer_add(&p->sleep_timer, ticks, proc_sleep_expired, p);
 
-    kprintf("PROC: [%u] \"%s\" sleeping for %u ticks (wake at %u)\n",
-            (uint32_t)p->pid, p->name, ticks, p->wakeup_tick);
+    cpu_irq_restore(flags);
+    sched_yield();
+}
 
+// short sleeps: the clockevent is armed for the exact deadline instead of the next tick (no log line: it would cost more than the sleep)
+void proc_sleep_ns(uint64_t ns) {
+
+    pcb_t *p = sched_current();
+    if (!p || ns == 0) return;
+
+    uint32_t flags = cpu_irq_save();                            // BLOCKED before the timer can fire
+
+    p->wakeup_ns = clock_ns() + ns;
+    p->state     = PROC_BLOCKED;
     sched_remove(p);
+    ktimer_add_ns(&p->sleep_timer, ns, proc_sleep_expired, p);
+
+    cpu_irq_restore(flags);
     sched_yield();
 }
 
@@ -404,7 +467,10 @@ void proc_wake(pcb_t *p) {
         return;
     }
 
+    ktimer_cancel(&p->sleep_timer);                             // woken before the deadline (or by it)
     p->wakeup_tick = 0;
+    p->wakeup_ns   = 0;
+    p->ns_woken    = clock_ns();                                // wake -> run latency measured at switch-in
     p->state       = PROC_READY;
     sched_add(p);
 
@@ -1,4 +1,6 @@
-// sched.c - Round-robin priority scheduler
+// sched.c - Priority scheduler
+//   real-time + idle : round-robin, O(1) bitmap-indexed FIFO run queue per priority
+//   fair (8 - 30)    : lowest weighted virtual runtime first, min-heap of PCBs
 
 #include "sched.h"
 #include "proc.h"
@@ -6,22 +8,240 @@
 #include "kprintf.h"
 #include "timer.h"
 #include "syscall.h"
-
-#define SCHED_MAX_PROCS MAX_PROCS
-
-static pcb_t   *ready_queue[SCHED_MAX_PROCS];       // pointers to READY / RUNNING PCBs
-static uint32_t queue_size  = 0;                    // number of entries in ready_queue
-static uint32_t current_idx = 0;                    // index of currently running process
+#include "pmm.h"
+#include "vmm.h"
+#include "cpu.h"
+
+#define SCHED_PRIO_LEVELS   (PROC_PRIO_IDLE + 1u)          // 32 run queues, one per priority
+#define SCHED_RT_MASK       ((1u << PROC_PRIO_FAIR_MIN) - 1u)   // real-time queues: ahead of the fair class
+
+// fair class tuning (ns)
+#define SCHED_FAIR_GRAN_NS      4000000ull          // lead over the leftmost task before preempting (4 ms)
+#define SCHED_FAIR_CREDIT_NS    10000000ull         // max vruntime credit a sleeper keeps over the fair clock (10 ms)
+#define SCHED_FAIR_WEIGHT_NORM  1024u               // weight of PROC_PRIO_NORMAL
+
+// CPU share weight per fair priority (PROC_PRIO_HIGH .. PROC_PRIO_IDLE - 1), ~1.25x per step
+static const uint32_t fair_weight[PROC_PRIO_FAIR_MAX - PROC_PRIO_FAIR_MIN + 1] = {
+    6100, 4904, 3906, 3121, 2501, 1991, 1586, 1277,         //  8 - 15
+    1024,  820,  655,  526,  423,  335,  272,  215,         // 16 - 23
+     172,  137,  110,   87,   70,   56,   45,               // 24 - 30
+};
+
+// run queues: FIFO per priority, bit p of rq_mask set = queue p non-empty (fair priorities never set a bit)
+// the running process is never queued: it goes back to the tail of its queue when preempted
+static pcb_t   *rq_head[SCHED_PRIO_LEVELS];
+static pcb_t   *rq_tail[SCHED_PRIO_LEVELS];
+static uint32_t rq_mask  = 0;
+static uint32_t nr_ready = 0;                       // processes queued
+
+// fair class: binary min-heap on vruntime, fair_heap[0] = next to run
+static pcb_t   *fair_heap[MAX_PROCS];
+static uint32_t fair_nr       = 0;
+static uint64_t fair_clock    = 0;                  // monotonic min vruntime of the class (placement reference)
 
 static pcb_t    *current_proc = 0;                  // currently running PCB
+static pcb_t    *idle_proc    = 0;                  // runs only when nothing else is READY
 static int      sched_enabled = 0;                  // 0 = disabled, 1 = active
 
 static volatile int tick_flag = 0;                  // only switch on timer interrupts
 
+// vruntime a < b (wrap-safe)
+static inline int vr_before(uint64_t a, uint64_t b) {
+    return (int64_t)(a - b) < 0;
+}
+
+static void heap_set(uint32_t i, pcb_t *p) {
+    fair_heap[i] = p;
+    p->heap_idx  = i;
+}
+
+static void heap_up(uint32_t i) {
+
+    pcb_t *p = fair_heap[i];
+
+    while (i > 0) {
+        uint32_t parent = (i - 1) / 2;
+        if (!vr_before(p->vruntime, fair_heap[parent]->vruntime)) break;
+        heap_set(i, fair_heap[parent]);
+        i = parent;
+    }
+    heap_set(i, p);
+}
+
+static void heap_down(uint32_t i) {
+
+    pcb_t *p = fair_heap[i];
+
+    for (;;) {
+        uint32_t child = 2 * i + 1;
+        if (child >= fair_nr) break;
+        if (child + 1 < fair_nr && vr_before(fair_heap[child + 1]->vruntime, fair_heap[child]->vruntime))
+            child++;
+        if (!vr_before(fair_heap[child]->vruntime, p->vruntime)) break;
+        heap_set(i, fair_heap[child]);
+        i = child;
+    }
+    heap_set(i, p);
+}
+
+// advance the fair clock to the smallest vruntime still competing (never backwards)
+static void fair_update_clock(void) {
+
+    int      have = 0;
+    uint64_t vmin = 0;
+
+    if (current_proc && current_proc->state == PROC_RUNNING && PROC_PRIO_IS_FAIR(current_proc->priority)) {
+        vmin = current_proc->vruntime;
+        have = 1;
+    }
+    if (fair_nr && (!have || vr_before(fair_heap[0]->vruntime, vmin))) {
+        vmin = fair_heap[0]->vruntime;
+        have = 1;
+    }
+
+    if (have && vr_before(fair_clock, vmin))
+        fair_clock = vmin;
+}
+
+// charge run time up to now (fair class: weighted into vruntime)
+static void sched_account(pcb_t *p, uint64_t now) {
+
+    uint64_t delta = now - p->ns_last_run;
+    p->ns_last_run = now;
+    p->ns_total   += delta;
+
+    if (PROC_PRIO_IS_FAIR(p->priority)) {
+        uint32_t w = fair_weight[p->priority - PROC_PRIO_FAIR_MIN];
+        p->vruntime += (w == SCHED_FAIR_WEIGHT_NORM) ? delta : delta * SCHED_FAIR_WEIGHT_NORM / w;
+        fair_update_clock();
+    }
+}
+
+// newly runnable (created / woken): at most SCHED_FAIR_CREDIT_NS behind the fair clock
+static void fair_place(pcb_t *p) {
+
+    uint64_t floor = fair_clock - SCHED_FAIR_CREDIT_NS;
+    if (fair_clock < SCHED_FAIR_CREDIT_NS) floor = 0;
+
+    if (vr_before(p->vruntime, floor))
+        p->vruntime = floor;
+}
+
+// fair current has run far enough ahead of the leftmost queued task
+static int fair_should_preempt(pcb_t *p) {
+    return PROC_PRIO_IS_FAIR(p->priority) && fair_nr
+        && vr_before(fair_heap[0]->vruntime + SCHED_FAIR_GRAN_NS, p->vruntime);
+}
+
+// append p to the tail of its priority's queue (fair class: into the heap)
+static void rq_enqueue(pcb_t *p) {
+
+    uint32_t prio = p->priority;
+
+    if (PROC_PRIO_IS_FAIR(prio)) {
+        fair_heap[fair_nr] = p;
+        heap_up(fair_nr++);
+        p->on_rq = 1;
+        nr_ready++;
+        return;
+    }
+
+    p->rq_next = 0;
+    p->rq_prev = rq_tail[prio];
+    if (rq_tail[prio]) rq_tail[prio]->rq_next = p;
+    else               rq_head[prio] = p;
+    rq_tail[prio] = p;
+
+    rq_mask |= 1u << prio;
+    p->on_rq = 1;
+    nr_ready++;
+}
+
+// unlink p from its queue
+static void rq_dequeue(pcb_t *p) {
+
+    uint32_t prio = p->priority;
+
+    if (PROC_PRIO_IS_FAIR(prio)) {
+        uint32_t i    = p->heap_idx;
+        pcb_t   *last = fair_heap[--fair_nr];
+        if (i < fair_nr) {                                          // fill the hole with the last leaf, restore order
+            heap_set(i, last);
+            heap_up(i);
+            heap_down(last->heap_idx);
+        }
+        p->on_rq = 0;
+        nr_ready--;
+        return;
+    }
+
+    if (p->rq_prev) p->rq_prev->rq_next = p->rq_next;
+    else            rq_head[prio] = p->rq_next;
+    if (p->rq_next) p->rq_next->rq_prev = p->rq_prev;
+    else            rq_tail[prio] = p->rq_prev;
+
+    if (!rq_head[prio])
+        rq_mask &= ~(1u << prio);
+
+    p->rq_next = p->rq_prev = 0;
+    p->on_rq = 0;
+    nr_ready--;
+}
+
+// dequeue the next process: real-time queues, then lowest vruntime, then idle (0 = nothing queued)
+static pcb_t *rq_pick(void) {
+
+    pcb_t *p;
+
+    if (rq_mask & SCHED_RT_MASK)
+        p = rq_head[cpu_bsf(rq_mask)];
+    else if (fair_nr)
+        p = fair_heap[0];
+    else if (rq_mask)
+        p = rq_head[cpu_bsf(rq_mask)];
+    else
+        return 0;
+
+    rq_dequeue(p);
+    return p;
+}
+
+// another task waiting for the CPU (idle alone in its queue does not count): periodic slices needed
+static int sched_contended(void) {
+
+    uint32_t mask = rq_mask;
+    if (idle_proc && rq_head[PROC_PRIO_IDLE] == idle_proc && rq_tail[PROC_PRIO_IDLE] == idle_proc)
+        mask &= ~(1u << PROC_PRIO_IDLE);
+
+    return mask != 0 || fair_nr != 0;
+}
+
+// tickless unless tasks compete: one task (or idle) only needs interrupts at its next timer deadline
+static void sched_update_tick(void) {
+    if (sched_enabled)
+        timer_set_tickless(!sched_contended());
+}
+
+// p switched in at now: start its run-time slice, record wake latency
+static void sched_account_in(pcb_t *p, uint64_t now) {
+
+    p->ns_last_run = now;
+
+    if (p->ns_woken) {
+        uint64_t lat = now - p->ns_woken;
+        if (lat > p->ns_wake_max) p->ns_wake_max = lat;
+        p->ns_woken = 0;
+    }
+}
+
 // reset scheduler on clean state
 void sched_init(void) {
-    queue_size    = 0;
-    current_idx   = 0;
+    for (uint32_t i = 0; i < SCHED_PRIO_LEVELS; i++)
+        rq_head[i] = rq_tail[i] = 0;
+    rq_mask       = 0;
+    nr_ready      = 0;
+    fair_nr       = 0;
+    fair_clock    = 0;
     current_proc  = 0;
     sched_enabled = 0;
     tick_flag     = 0;
@@ -36,42 +256,57 @@ void sched_add(pcb_t *p) {
         return;
     }
 
-    if (queue_size >= SCHED_MAX_PROCS) {                            // ensure queue = not full
-        kprintf("SCHED: sched_add - queue full\n");
+    if (p->on_rq) {                                                 // ensure proc = not queued twice
+        kprintf("SCHED: sched_add - [%u] already queued\n", (uint32_t)p->pid);
         return;
     }
 
-    // insert into queue
-    ready_queue[queue_size++] = p;
-    kprintf("SCHED: [%u] \"%s\" added to queue (queue_size=%u)\n", (uint32_t)p->pid, p->name, queue_size);
+    // insert at the tail of its priority queue (fair: bounded sleeper credit, then into the heap)
+    uint32_t flags = cpu_irq_save();                                // timer tick may wake / switch meanwhile
+    if (PROC_PRIO_IS_FAIR(p->priority))
+        fair_place(p);
+    rq_enqueue(p);
+    sched_update_tick();                                            // competition for the CPU: periodic ticks back on
+
+    int preempt = 0;                                                // more urgent work arrived: end current slice on next tick
+    if (current_proc && PROC_PRIO_IS_FAIR(p->priority) && PROC_PRIO_IS_FAIR(current_proc->priority)) {
+        sched_account(current_proc, clock_ns());
+        preempt = vr_before(p->vruntime + SCHED_FAIR_GRAN_NS, current_proc->vruntime);
+    } else if (current_proc) {
+        preempt = p->priority < current_proc->priority;
+    }
+    if (preempt)
+        current_proc->timeslice = 1;
+    cpu_irq_restore(flags);
+
+    kprintf("SCHED: [%u] \"%s\" added to queue (prio=%u ready=%u)\n", (uint32_t)p->pid, p->name, (uint32_t)p->priority, nr_ready);
 }
 
-// remove process from ready queue
-void sched_remove(pcb_t *p) {
+// idle thread: background work while nothing is runnable, then halt until next interrupt
+static void sched_idle(void) {
+    pmm_init_deferred();                                            // bring RAM above the early window online
 
-    for (uint32_t i = 0; i < queue_size; i++) {
-        if (ready_queue[i] == p) {
-            ready_queue[i] = ready_queue[--queue_size];
-            ready_queue[queue_size] = 0;
-            return;
-        }
+    for (;;) {
+        pmm_zero_idle();                                            // top up pre-zeroed frame pool
+        asm volatile ("hlt");
     }
 }
 
-// Called from timer_handler() on every PIT tick.
-void sched_tick(void) {
+// remove process from ready queue (running process = not queued: nothing to do)
+void sched_remove(pcb_t *p) {
 
-    tick_flag = 1;
+    if (!p) return;
 
-    uint32_t now = timer_get_ticks();
-    for (pid_t i = 0; i < MAX_PROCS; i++) {
-        pcb_t *p = proc_get(i);
-        if (!p) continue;
-        if (p->state != PROC_BLOCKED) continue;
-        if (p->wakeup_tick == 0) continue;
-        if (p->wakeup_tick <= now)
-            proc_wake(p);
-    }
+    uint32_t flags = cpu_irq_save();
+    if (p->on_rq)
+        rq_dequeue(p);
+    sched_update_tick();
+    cpu_irq_restore(flags);
+}
+
+// Called from timer_handler() on every PIT tick (sleepers are woken by their ktimer before this).
+void sched_tick(void) {
+    tick_flag = 1;
 }
 
 // return current process
@@ -88,59 +323,60 @@ uint32_t sched_switch_esp(uint32_t current_esp) {
 
     if (!current_proc) return 0;
 
+    uint64_t now = clock_ns();
+    sched_account(current_proc, now);
+
     // decrement timeslice
     if (current_proc->timeslice > 0)
         current_proc->timeslice--;
 
-    // timeslice remaining: continue running current process
-    if (current_proc->timeslice > 0) return 0;
-
-    // find next READY process (highest priority = lowest number)
-    pcb_t *next = 0;
-    uint32_t next_idx = 0;
-    uint8_t  best_prio = 255;
-
-    for (uint32_t i = 0; i < queue_size; i++) {
-
-        pcb_t *p = ready_queue[i];
-        if (!p) continue;
-        if (p == current_proc) continue;           // skip current
-        if (p->state != PROC_READY) continue;      // skip non-runnable
-
-        if (p->priority < best_prio) {
-            best_prio = p->priority;
-            next      = p;
-            next_idx  = i;
-        }
-    }
+    // timeslice remaining (and, fair class, not too far ahead of the leftmost): continue running current process
+    if (current_proc->timeslice > 0 && !fair_should_preempt(current_proc)) return 0;
 
     // no other process is ready: reset timeslice and keep running
-    if (!next) {
+    if (!rq_mask && !fair_nr) {
         current_proc->timeslice = current_proc->timeslice_len;
+        sched_update_tick();
         return 0;
     }
 
-    // 1. save the current kernel-stack pointer
-    current_proc->esp_kernel = current_esp;
-    current_proc->ticks_total += current_proc->timeslice_len;
-    current_proc->tick_last_run = timer_get_ticks();
+    // still runnable: back to the tail of its queue (round-robin among equal priorities)
     if (current_proc->state == PROC_RUNNING) {
         current_proc->state = PROC_READY;
+        rq_enqueue(current_proc);
+    }
+
+    // next process = head of the highest-priority non-empty queue (one bsf), or the lowest vruntime
+    pcb_t *next = rq_pick();
+
+    // still the most urgent (alone at its priority / still leftmost): keep running
+    if (next == current_proc) {
+        current_proc->state     = PROC_RUNNING;
+        current_proc->timeslice = current_proc->timeslice_len;
+        sched_update_tick();
+        return 0;
     }
 
-    // 2. advance the current index (simple round-robin tie-break)
-    current_idx = next_idx;
+    // 1. save the current kernel-stack pointer (run time charged above)
+    current_proc->esp_kernel = current_esp;
 
-    // 3. activate the chosen process
+    // 2. activate the chosen process
     current_proc = next;
     current_proc->state      = PROC_RUNNING;
     current_proc->timeslice  = current_proc->timeslice_len;
     current_proc->ticks_scheduled++;
+    sched_account_in(current_proc, now);
+
+    // 3. switch address space (CR3 untouched when both share a directory)
+    vmm_switch(current_proc->page_directory);
 
     // 4. update TSS.esp0
     tss_set_esp0(current_proc->esp0);
 
-    // 5. return new esp: irq.asm will load before iret
+    // 5. periodic ticks only while something else still waits for the CPU
+    sched_update_tick();
+
+    // 6. return new esp: irq.asm will load before iret
     return current_proc->esp_kernel;
 }
 
@@ -149,43 +385,38 @@ extern void sched_start_first(uint32_t new_esp);
 // launch scheduler
 void sched_start(void) {
 
-    if (queue_size == 0) {
-        kprintf("SCHED: sched_start - no processes in queue\n");
-        return;
+    if (!idle_proc) {                                                   // idle thread = always something to run
+        idle_proc = proc_create("idle", PROC_PRIO_IDLE);
+        if (idle_proc) {
+            proc_init_frame(idle_proc, (uint32_t)sched_idle);
+            proc_set_ready(idle_proc);
+            sched_add(idle_proc);
+        }
     }
 
     // pick the highest-priority READY process
-    pcb_t   *first    = 0;
-    uint32_t first_idx = 0;
-    uint8_t  best_prio = 255;
-
-    for (uint32_t i = 0; i < queue_size; i++) {
-        pcb_t *p = ready_queue[i];
-        if (p && p->state == PROC_READY && p->priority < best_prio) {
-            best_prio = p->priority;
-            first     = p;
-            first_idx = i;
-        }
-    }
+    pcb_t *first = rq_pick();
 
     if (!first) {
-        kprintf("SCHED: sched_start - no READY process found\n");
+        kprintf("SCHED: sched_start - no processes in queue\n");
         return;
     }
 
     current_proc  = first;                                              // active process
-    current_idx   = first_idx;
 
     current_proc->state = PROC_RUNNING;                                 // update state
     current_proc->ticks_scheduled++;
+    sched_account_in(current_proc, clock_ns());
 
     sched_enabled = 1;                                                  // enable scheduler
 
+    vmm_switch(current_proc->page_directory);                           // load its address space
     tss_set_esp0(current_proc->esp0);                                   // update TSS
 
     kprintf("SCHED: Starting - first process [%u] \"%s\"\n", (uint32_t)current_proc->pid, current_proc->name);
 
     asm volatile ("cli");                                               // disable interrupts
+    sched_update_tick();                                                // nothing else ready: stop the periodic tick
     sched_start_first(current_proc->esp_kernel);                        // start first process
 
 }
@@ -194,8 +425,9 @@ void sched_start(void) {
 void sched_dump(void) {
 
     kprintf("SCHED: -- scheduler dump --\n");
-    kprintf("SCHED: enabled=%d  queue_size=%u  current_idx=%u\n",
-            sched_enabled, queue_size, current_idx);
+    kprintf("SCHED: enabled=%d  ready=%u  queue mask=%p  fair=%u  fair clock=%u us\n",
+            sched_enabled, nr_ready, rq_mask, fair_nr, (uint32_t)(fair_clock / 1000u));
+    timer_stats();
 
     if (current_proc)
         kprintf("SCHED: current = [%u] \"%s\"  timeslice=%u\n",
@@ -204,14 +436,21 @@ void sched_dump(void) {
     else
         kprintf("SCHED: current = (none)\n");
 
-    for (uint32_t i = 0; i < queue_size; i++) {
-        pcb_t *p = ready_queue[i];
-        if (!p) continue;
-        kprintf("SCHED:   [%u] idx=%u \"%s\" state=%s prio=%u slice=%u\n",
-                (uint32_t)p->pid, i, p->name,
+    for (uint32_t prio = 0; prio < SCHED_PRIO_LEVELS; prio++) {        // queue order = run order
+        uint32_t pos = 0;
+        for (pcb_t *p = rq_head[prio]; p; p = p->rq_next, pos++)
+            kprintf("SCHED:   [%u] prio=%u pos=%u \"%s\" state=%s slice=%u\n",
+                    (uint32_t)p->pid, prio, pos, p->name,
+                    proc_state_name(p->state),
+                    p->timeslice);
+    }
+
+    for (uint32_t i = 0; i < fair_nr; i++) {                            // heap order (slot 0 = next)
+        pcb_t *p = fair_heap[i];
+        kprintf("SCHED:   [%u] prio=%u heap=%u \"%s\" state=%s vruntime=%u us\n",
+                (uint32_t)p->pid, (uint32_t)p->priority, i, p->name,
                 proc_state_name(p->state),
-                (uint32_t)p->priority,
-                p->timeslice);
+                (uint32_t)(p->vruntime / 1000u));
     }
     kprintf("\n");
 }
@@ -4,6 +4,7 @@
 #include "proc.h"
 #include "sched.h"
 #include "vga.h"
+#include "timer.h"
 #include "kprintf.h"
 
 // SYS_YIELD (0): voluntarily give up the CPU
@@ -58,6 +59,24 @@ static int32_t sys_write(regs_t *r) {
     return 0;
 }
 
+// SYS_CLOCK (7): monotonic nanoseconds (64-bit: stored through EBX, low 32 bits also returned)
+static int32_t sys_clock(regs_t *r) {
+    uint64_t *out = (uint64_t *)r->ebx;
+    if (out && (uint32_t)out > KERNEL_VIRT_BASE - sizeof(uint64_t))            // user half only: never write kernel memory
+        return -1;
+
+    uint64_t  ns  = clock_ns();
+    if (out) *out = ns;
+    return (int32_t)(uint32_t)ns;
+}
+
+// SYS_SLEEP_NS (8): sleep for N nanoseconds (sub-tick precision)
+static int32_t sys_sleep_ns(regs_t *r) {
+    uint64_t ns = ((uint64_t)r->ecx << 32) | r->ebx;
+    proc_sleep_ns(ns);
+    return 0;
+}
+
 typedef int32_t (*syscall_fn_t)(regs_t *);
 
 // define dispatch table
@@ -69,6 +88,8 @@ static syscall_fn_t syscall_table[SYSCALL_COUNT] = {
     [SYS_FORK]   = sys_fork,
     [SYS_EXEC]   = sys_exec,
     [SYS_WRITE]  = sys_write,
+    [SYS_CLOCK]  = sys_clock,
+    [SYS_SLEEP_NS] = sys_sleep_ns,
 };
 
 void syscall_dispatch(regs_t *r) {
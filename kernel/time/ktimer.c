@@ -0,0 +1,194 @@
+// ktimer.c - Kernel timers (hashed hierarchical timing wheel)
+
+// tv[0] : 256 slots, slot = expires & 255           (timers due within 256 ticks)
+// tv[n] : 64 slots,  slot = (expires >> (8 + 6(n-1))) & 63
+// every 256 ticks the next tv[1] slot is cascaded down (re-hashed into tv[0]), and so on up the levels
+// add / cancel = O(1) list ops, tick = expired timers + the occasional cascade
+
+#include "ktimer.h"
+#include "timer.h"
+#include "cpu.h"
+
+#define TV1_SIZE   (1u << KTIMER_TV1_BITS)
+#define TVN_SIZE   (1u << KTIMER_TVN_BITS)
+#define TV1_MASK   (TV1_SIZE - 1u)
+#define TVN_MASK   (TVN_SIZE - 1u)
+
+static ktimer_t *tv1[TV1_SIZE];
+static ktimer_t *tvn[KTIMER_LEVELS - 1][TVN_SIZE];
+
+static uint32_t wheel_tick = 0;                     // next tick to process (everything before it has run)
+
+static ktimer_t *ns_head = 0;                       // ns timers, sorted by expires_ns (few: short sleeps only)
+
+// bucket of a timer relative to wheel_tick
+static ktimer_t **slot_for(uint32_t expires) {
+
+    uint32_t delta = expires - wheel_tick;
+
+    if ((int32_t)delta < 0)                                         // already due: next slot processed
+        return &tv1[wheel_tick & TV1_MASK];
+
+    if (delta < TV1_SIZE)
+        return &tv1[expires & TV1_MASK];
+
+    for (uint32_t lvl = 0; lvl < KTIMER_LEVELS - 1; lvl++) {
+        uint32_t shift = KTIMER_TV1_BITS + (lvl + 1) * KTIMER_TVN_BITS;
+        if (delta < (1u << shift) || lvl == KTIMER_LEVELS - 2)
+            return &tvn[lvl][(expires >> (shift - KTIMER_TVN_BITS)) & TVN_MASK];
+    }
+
+    return 0;                                                       // unreachable
+}
+
+static void link_timer(ktimer_t *t) {
+
+    ktimer_t **head = slot_for(t->expires);
+
+    t->next  = *head;
+    t->pprev = head;
+    if (*head) (*head)->pprev = &t->next;
+    *head = t;
+}
+
+static void unlink_timer(ktimer_t *t) {
+
+    *t->pprev = t->next;
+    if (t->next) t->next->pprev = t->pprev;
+    t->next  = 0;
+    t->pprev = 0;
+}
+
+// re-hash every timer of one upper-level slot into the levels below, return the slot index
+static uint32_t cascade(uint32_t lvl) {
+
+    uint32_t shift = KTIMER_TV1_BITS + lvl * KTIMER_TVN_BITS;
+    uint32_t idx   = (wheel_tick >> shift) & TVN_MASK;
+
+    ktimer_t *t = tvn[lvl][idx];
+    tvn[lvl][idx] = 0;
+
+    while (t) {
+        ktimer_t *next = t->next;
+        link_timer(t);
+        t = next;
+    }
+
+    return idx;
+}
+
+void ktimer_add(ktimer_t *t, uint32_t delay, ktimer_fn_t fn, void *arg) {
+
+    if (delay > KTIMER_MAX_DELAY) delay = KTIMER_MAX_DELAY;
+
+    uint32_t flags = cpu_irq_save();
+
+    if (t->pprev)                                                   // pending: re-arm
+        unlink_timer(t);
+
+    t->fn      = fn;
+    t->arg     = arg;
+    t->expires = timer_get_ticks() + delay;
+    link_timer(t);
+
+    timer_rearm();                                                  // tickless: may be due before the programmed one-shot
+
+    cpu_irq_restore(flags);
+}
+
+void ktimer_add_ns(ktimer_t *t, uint64_t delay_ns, ktimer_fn_t fn, void *arg) {
+
+    uint32_t flags = cpu_irq_save();
+
+    if (t->pprev)                                                   // pending: re-arm
+        unlink_timer(t);
+
+    t->fn         = fn;
+    t->arg        = arg;
+    t->expires_ns = clock_ns() + delay_ns;
+
+    ktimer_t **link = &ns_head;                                     // insert sorted (equal deadlines keep FIFO order)
+    while (*link && (*link)->expires_ns <= t->expires_ns)
+        link = &(*link)->next;
+
+    t->next  = *link;
+    t->pprev = link;
+    if (*link) (*link)->pprev = &t->next;
+    *link = t;
+
+    timer_rearm();                                                  // one-shot at the new first deadline
+
+    cpu_irq_restore(flags);
+}
+
+uint32_t ktimer_run_ns(uint64_t now) {
+
+    uint32_t run = 0;
+
+    while (ns_head && ns_head->expires_ns <= now) {
+        ktimer_t *t = ns_head;
+        unlink_timer(t);                                            // callback may re-arm it
+        t->fn(t->arg);
+        run++;
+    }
+
+    return run;
+}
+
+uint64_t ktimer_next_ns(void) {
+    return ns_head ? ns_head->expires_ns : 0;
+}
+
+int ktimer_cancel(ktimer_t *t) {
+
+    uint32_t flags = cpu_irq_save();
+
+    int pending = t->pprev != 0;
+    if (pending)
+        unlink_timer(t);
+
+    cpu_irq_restore(flags);
+    return pending;
+}
+
+int ktimer_pending(const ktimer_t *t) {
+    return t->pprev != 0;
+}
+
+uint32_t ktimer_next_due(uint32_t now, uint32_t limit) {
+
+    if ((int32_t)(now - wheel_tick) >= 0)                          // ticks not processed yet: as soon as possible
+        return 1;
+
+    for (uint32_t d = 1; d < limit; d++) {                          // tv1 slots are exact for the next 256 ticks
+        uint32_t tick = now + d;
+        if ((tick & TV1_MASK) == 0 || tv1[tick & TV1_MASK])         // cascade may bring timers down
+            return d;
+    }
+
+    return limit;
+}
+
+void ktimer_run(uint32_t now) {
+
+    while ((int32_t)(now - wheel_tick) >= 0) {
+
+        uint32_t idx = wheel_tick & TV1_MASK;
+
+        if (idx == 0) {                                             // tv1 wrapped: pull the next slot of each level down
+            for (uint32_t lvl = 0; lvl < KTIMER_LEVELS - 1; lvl++)
+                if (cascade(lvl) != 0) break;                       // upper level only when this one wrapped too
+        }
+
+        ktimer_t *due = tv1[idx];                                   // detach: callbacks may re-arm or cancel any timer
+        tv1[idx] = 0;
+        if (due) due->pprev = &due;
+        wheel_tick++;
+
+        while (due) {
+            ktimer_t *t = due;
+            unlink_timer(t);                                        // due = next, t no longer pending
+            t->fn(t->arg);
+        }
+    }
+}
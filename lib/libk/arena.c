@@ -0,0 +1,81 @@
+// arena.c - scoped bump allocator over page-granular chunks (kpage.h)
+
+#include "arena.h"
+#include "kpage.h"
+#include "pmm.h"
+
+#define ARENA_ROUND(n) (((n) + ARENA_ALIGN - 1u) & ~(size_t)(ARENA_ALIGN - 1u))
+
+#define CHUNK_HDR  ARENA_ROUND(sizeof(arena_chunk_t))
+#define ARENA_HDR  ARENA_ROUND(sizeof(arena_t))
+
+static arena_chunk_t *chunk_new(uint32_t pages, arena_chunk_t *next) {
+
+    arena_chunk_t *c = (arena_chunk_t *)kpage_alloc(pages);
+    if (!c) return 0;
+
+    c->next  = next;
+    c->pages = pages;
+    return c;
+}
+
+arena_t *arena_create(void) {
+
+    arena_chunk_t *c = chunk_new(ARENA_CHUNK_PAGES, 0);
+    if (!c) return 0;
+
+    arena_t *a = (arena_t *)((char *)c + CHUNK_HDR);                            // header = first bytes of the first chunk
+    a->chunks = c;
+    a->ptr    = (char *)a + ARENA_HDR;
+    a->end    = (char *)c + ARENA_CHUNK_PAGES * PAGE_SIZE;
+    a->used   = 0;
+    return a;
+}
+
+void *arena_alloc(arena_t *a, size_t size) {
+
+    size = ARENA_ROUND(size ? size : 1u);
+
+    if (size > (size_t)(a->end - a->ptr)) {                                     // current chunk exhausted: start another
+
+        uint32_t pages = (uint32_t)((CHUNK_HDR + size + PAGE_SIZE - 1u) / PAGE_SIZE);
+        if (pages < ARENA_CHUNK_PAGES) pages = ARENA_CHUNK_PAGES;
+
+        arena_chunk_t *c = chunk_new(pages, a->chunks);
+        if (!c) return 0;
+
+        a->chunks = c;
+        a->ptr    = (char *)c + CHUNK_HDR;
+        a->end    = (char *)c + pages * PAGE_SIZE;
+    }
+
+    void *p = a->ptr;
+    a->ptr  += size;
+    a->used += size;
+    return p;
+}
+
+void arena_reset(arena_t *a) {
+
+    while (a->chunks->next) {                                                   // every chunk but the one holding the header
+        arena_chunk_t *c = a->chunks;
+        a->chunks = c->next;
+        kpage_free(c, c->pages);
+    }
+
+    a->ptr  = (char *)a + ARENA_HDR;
+    a->end  = (char *)a->chunks + a->chunks->pages * PAGE_SIZE;
+    a->used = 0;
+}
+
+void arena_destroy(arena_t *a) {
+
+    if (!a) return;
+
+    arena_chunk_t *c = a->chunks;                                               // header goes with the last chunk
+    while (c) {
+        arena_chunk_t *next = c->next;
+        kpage_free(c, c->pages);
+        c = next;
+    }
+}